@@ -0,0 +1,157 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright 2021, Marcin Ślusarz <marcin.slusarz@gmail.com>
+ */
+
+/*
+ * Compares strtoll_safe2 / strtod_safe2 with plain strtoll / strtod on
+ * random values, like the ones found in CSV files.
+ *
+ * Usage: bench-numbers [number-of-values [rounds]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils.h"
+
+#define VAL_SIZE 32
+
+static char *Ints;
+static char *Floats;
+static size_t Count;
+
+static volatile long long Sink_ll;
+static volatile double Sink_dbl;
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void
+generate(void)
+{
+	Ints = xmalloc_nofail(Count, VAL_SIZE);
+	Floats = xmalloc_nofail(Count, VAL_SIZE);
+
+	srand(1);
+	for (size_t i = 0; i < Count; ++i) {
+		long long v = ((long long)rand() << 20) ^ rand();
+		v >>= rand() % 40;
+		if (rand() % 4 == 0)
+			v = -v;
+
+		snprintf(&Ints[i * VAL_SIZE], VAL_SIZE, "%lld", v);
+
+		double d = (double)v / (1 << (rand() % 16));
+		snprintf(&Floats[i * VAL_SIZE], VAL_SIZE, "%.*f",
+				rand() % 7, d);
+	}
+}
+
+static int
+libc_ll(const char *str, long long *val)
+{
+	char *end;
+	*val = strtoll(str, &end, 0);
+	return *end != 0;
+}
+
+static int
+csv_ll(const char *str, long long *val)
+{
+	return strtoll_safe2(str, val, 0, false);
+}
+
+static int
+libc_dbl(const char *str, double *val)
+{
+	char *end;
+	*val = strtod(str, &end);
+	return *end != 0;
+}
+
+static int
+csv_dbl(const char *str, double *val)
+{
+	return strtod_safe2(str, val, false);
+}
+
+static double
+bench_ll(int (*parse)(const char *, long long *))
+{
+	double start = now();
+	long long sum = 0;
+
+	for (size_t i = 0; i < Count; ++i) {
+		long long v;
+		if (parse(&Ints[i * VAL_SIZE], &v) == 0)
+			sum += v;
+	}
+	Sink_ll = sum;
+
+	return (now() - start) / (double)Count;
+}
+
+static double
+bench_dbl(int (*parse)(const char *, double *))
+{
+	double start = now();
+	double sum = 0;
+
+	for (size_t i = 0; i < Count; ++i) {
+		double v;
+		if (parse(&Floats[i * VAL_SIZE], &v) == 0)
+			sum += v;
+	}
+	Sink_dbl = sum;
+
+	return (now() - start) / (double)Count;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long long rounds = 5;
+	unsigned long long count = 1000000;
+
+	if (argc > 1 && (strtoull_safe(argv[1], &count, 0) || count == 0))
+		exit(2);
+	if (argc > 2 && (strtoull_safe(argv[2], &rounds, 0) || rounds == 0))
+		exit(2);
+
+	Count = count;
+	generate();
+
+	printf("%zu values, best of %llu rounds, ns per value\n", Count, rounds);
+
+	double best[4] = { 1e30, 1e30, 1e30, 1e30 };
+	for (unsigned long long r = 0; r < rounds; ++r) {
+		double t[4];
+		t[0] = bench_ll(libc_ll);
+		t[1] = bench_ll(csv_ll);
+		t[2] = bench_dbl(libc_dbl);
+		t[3] = bench_dbl(csv_dbl);
+
+		for (size_t i = 0; i < 4; ++i)
+			if (t[i] < best[i])
+				best[i] = t[i];
+	}
+
+	printf("int    strtoll %6.1f  strtoll_safe2 %6.1f  (%.1fx)\n",
+			best[0], best[1], best[0] / best[1]);
+	printf("float  strtod  %6.1f  strtod_safe2  %6.1f  (%.1fx)\n",
+			best[2], best[3], best[2] / best[3]);
+
+	free(Ints);
+	free(Floats);
+
+	return 0;
+}
@@ -54,6 +54,9 @@ struct cb_params {
 
 	size_t table_column;
 	char *table;
+
+	char *unquoted;
+	size_t unquoted_size;
 };
 
 static int
@@ -91,16 +94,12 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 	for (size_t i = 0; i < params->count; ++i) {
 		if (params->elements[i].is_column) {
 			const char *str = &buf[col_offs[params->elements[i].colnum]];
-			const char *unquoted = str;
-			if (str[0] == '"')
-				unquoted = csv_unquot(str);
+			const char *unquoted = csv_unquot_buf(str,
+					&params->unquoted,
+					&params->unquoted_size);
 
 			len = strlen(unquoted);
 			memcpy(outbuf + start, unquoted, len);
-
-			if (str[0] == '"')
-				free((char *)unquoted);
-
 		} else {
 			len = strlen(params->elements[i].str);
 			memcpy(outbuf + start, params->elements[i].str, len);
@@ -237,6 +236,7 @@ main(int argc, char *argv[])
 
 	free(params.elements);
 	free(params.table);
+	free(params.unquoted);
 
 	return 0;
 }
@@ -49,6 +49,10 @@ usage(FILE *out)
 struct subst {
 	size_t argv_idx;
 	size_t col;
+
+	/* space for unquoted value, reused between rows */
+	char *unquoted;
+	size_t unquoted_size;
 };
 
 struct cb_params {
@@ -61,6 +65,9 @@ struct cb_params {
 
 	size_t table_column;
 	char *table;
+
+	char *unquoted;
+	size_t unquoted_size;
 };
 
 static void
@@ -132,6 +139,15 @@ next_row(const char *buf, const size_t *col_offs,size_t ncols, void *arg)
 		}
 	}
 
+	/* done before fork, so that buffers can be reused for the next row */
+	for (size_t i = 0; i < params->nsubsts; ++i) {
+		struct subst *subst = &params->substs[i];
+		const char *d = csv_unquot_buf(&buf[col_offs[subst->col]],
+				&subst->unquoted, &subst->unquoted_size);
+
+		params->argv[subst->argv_idx] = (char *)d;
+	}
+
 	if (pipe(child_in) < 0) {
 		perror("pipe");
 		exit(2);
@@ -151,15 +167,6 @@ next_row(const char *buf, const size_t *col_offs,size_t ncols, void *arg)
 	if (pid == 0) {
 		char **argv = params->argv;
 
-		for (size_t i = 0; i < params->nsubsts; ++i) {
-			struct subst *subst = &params->substs[i];
-			char *d = (char *)&buf[col_offs[subst->col]];
-			if (d[0] == '"')
-				d = csv_unquot(d);
-
-			argv[subst->argv_idx] = d;
-		}
-
 		if (close(child_in[1])) {
 			perror("close");
 			exit(2);
@@ -198,15 +205,11 @@ next_row(const char *buf, const size_t *col_offs,size_t ncols, void *arg)
 	}
 
 	if (params->stdin_col != SIZE_MAX) {
-		char *str = (char *)&buf[col_offs[params->stdin_col]];
-		char *unquot = str;
-		if (str[0] == '"')
-			unquot = csv_unquot(str);
+		const char *unquot = csv_unquot_buf(
+				&buf[col_offs[params->stdin_col]],
+				&params->unquoted, &params->unquoted_size);
 
 		write_all(child_in[1], unquot, strlen(unquot));
-
-		if (str[0] == '"')
-			free(unquot);
 	}
 
 	if (close(child_in[1])) {
@@ -342,6 +345,8 @@ main(int argc, char *argv[])
 
 			params.substs[params.nsubsts - 1].argv_idx = idx;
 			params.substs[params.nsubsts - 1].col = col;
+			params.substs[params.nsubsts - 1].unquoted = NULL;
+			params.substs[params.nsubsts - 1].unquoted_size = 0;
 		} else {
 			params.argv[idx] = argv[i];
 		}
@@ -381,9 +386,12 @@ main(int argc, char *argv[])
 
 	csv_destroy_ctx(s);
 
+	for (size_t i = 0; i < params.nsubsts; ++i)
+		free(params.substs[i].unquoted);
 	free(params.substs);
 	free(params.argv);
 	free(params.table);
+	free(params.unquoted);
 	free(stdin_colname);
 	free(input_buf);
 
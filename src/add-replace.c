@@ -75,7 +75,7 @@ struct cb_params {
 
 	union {
 		struct {
-			regex_t *regex;
+			struct csv_regex *regex;
 
 #define MAX_MATCHES 9
 			regmatch_t matches[MAX_MATCHES + 1];
@@ -97,6 +97,9 @@ struct cb_params {
 	char *buf;
 	size_t buf_len;
 
+	char *unquoted;
+	size_t unquoted_size;
+
 	size_t table_column;
 	char *table;
 };
@@ -119,12 +122,11 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 	}
 
 	const char *str = &buf[col_offs[params->col]];
-	const char *unquoted = str;
+	const char *unquoted = csv_unquot_buf(str, &params->unquoted,
+			&params->unquoted_size);
 	bool print_buf = false;
 	size_t used;
 
-	if (str[0] == '"')
-		unquoted = csv_unquot(str);
 	params->buf[0] = 0;
 
 	if (params->type == csv_string) {
@@ -134,8 +136,8 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 		if (print_buf)
 			used = strlen(params->buf);
 	} else {
-		print_buf = regexec(params->r.regex, unquoted, MAX_MATCHES,
-				params->r.matches, 0) == 0;
+		print_buf = csv_regex_exec(params->r.regex, unquoted,
+				MAX_MATCHES, params->r.matches) == 0;
 
 		if (print_buf) {
 			if (params->r.matches[params->r.max_expr].rm_so == -1) {
@@ -200,9 +202,6 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 
 	fputc('\n', stdout);
 
-	if (str[0] == '"')
-		free((char *)unquoted);
-
 	return 0;
 }
 
@@ -420,6 +419,7 @@ main(int argc, char *argv[])
 	}
 
 	free(params.buf);
+	free(params.unquoted);
 	free(params.table);
 
 	return 0;
@@ -51,6 +51,9 @@ struct cb_params {
 
 	wchar_t *wcs;
 	size_t wcs_size;
+
+	char *unquoted;
+	size_t unquoted_size;
 };
 
 static int
@@ -74,11 +77,10 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 	fputc(',', stdout);
 
 	const char *str = &buf[col_offs[params->col]];
-	const char *unquoted = str;
-	if (str[0] == '"') {
-		unquoted = csv_unquot(str);
+	const char *unquoted = csv_unquot_buf(str, &params->unquoted,
+			&params->unquoted_size);
+	if (str[0] == '"')
 		fputc('"', stdout);
-	}
 
 	size_t len = mbstowcs(NULL, unquoted, 0);
 
@@ -102,10 +104,8 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 			fprintf(stdout, "%lc", params->wcs[len - i - 1]);
 	}
 
-	if (str[0] == '"') {
+	if (str[0] == '"')
 		fputc('"', stdout);
-		free((char *)unquoted);
-	}
 
 	fputc('\n', stdout);
 
@@ -128,6 +128,8 @@ main(int argc, char *argv[])
 	params.table_column = SIZE_MAX;
 	params.wcs = NULL;
 	params.wcs_size = 0;
+	params.unquoted = NULL;
+	params.unquoted_size = 0;
 
 	while ((opt = getopt_long(argc, argv, "c:n:sST:", opts, NULL)) != -1) {
 		switch (opt) {
@@ -212,6 +214,7 @@ main(int argc, char *argv[])
 
 	free(params.table);
 	free(params.wcs);
+	free(params.unquoted);
 
 	return 0;
 }
@@ -108,35 +108,37 @@ struct cb_params {
 
 	size_t table_column;
 	char *table;
+
+	struct csv_values row;
 };
 
 static void
-process_exp(struct rpn_expression *exp, const char *buf, const size_t *col_offs,
-		char sep)
+process_exp(struct rpn_expression *exp, struct csv_values *row, char sep)
 {
 	struct rpn_variant ret;
 
-	if (rpn_eval(exp, buf, col_offs, &ret))
+	if (rpn_eval(exp, row, &ret))
 		exit(2);
 
 	if (ret.type == RPN_LLONG) {
-		printf("%lld%c", ret.llong, sep);
+		csv_print_int(stdout, ret.llong);
+		fputc(sep, stdout);
 	} else if (ret.type == RPN_PCHAR) {
 		csv_print_quoted(ret.pchar, strlen(ret.pchar));
 		fputc(sep, stdout);
-		free(ret.pchar);
 	} else if (ret.type == RPN_DOUBLE) {
-		printf("%f%c", ret.dbl, sep);
+		csv_print_double(stdout, ret.dbl);
+		fputc(sep, stdout);
 	} else {
 		fprintf(stderr, "unknown type %d\n", ret.type);
 		exit(2);
 	}
 }
 
-static int
-next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
+static void
+process_row(struct cb_params *params, const char *buf, const size_t *col_offs,
+		size_t ncols)
 {
-	struct cb_params *params = arg;
 	struct rpn_expression *exp;
 
 	if (params->table) {
@@ -147,22 +149,36 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 			putchar(',');
 			putchar('\n');
 
-			return 0;
+			return;
 		}
 	}
 
 	csv_print_line(stdout, buf, col_offs, ncols, false);
 	fputc(',', stdout);
 
+	csv_values_set_row(&params->row, buf, col_offs);
+
 	for (size_t i = 0; i < params->count - 1; ++i) {
 		exp = &params->expressions[i];
 
-		process_exp(exp, buf, col_offs, ',');
+		process_exp(exp, &params->row, ',');
 	}
 
 	exp = &params->expressions[params->count - 1];
 
-	process_exp(exp, buf, col_offs, '\n');
+	process_exp(exp, &params->row, '\n');
+}
+
+static int
+next_batch(const struct csv_batch *batch, void *arg)
+{
+	struct cb_params *params = arg;
+	size_t ncols = batch->ncols;
+
+	for (size_t r = 0; r < batch->nrows; ++r) {
+		process_row(params, &batch->buf[batch->row_offs[r]],
+				&batch->col_offs[r * ncols], ncols);
+	}
 
 	return 0;
 }
@@ -295,7 +311,11 @@ main(int argc, char *argv[])
 	free(expressions);
 	free(names);
 
-	csv_read_all_nofail(s, &next_row, &params);
+	csv_values_init(&params.row, nheaders);
+
+	csv_read_batches_nofail(s, &next_batch, &params);
+
+	csv_values_fini(&params.row);
 
 	csv_destroy_ctx(s);
 
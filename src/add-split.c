@@ -61,6 +61,9 @@ struct cb_params {
 
 	size_t table_column;
 	char *table;
+
+	char *unquoted;
+	size_t unquoted_size;
 };
 
 static int
@@ -85,9 +88,8 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 	fputc(',', stdout);
 
 	const char *str = &buf[col_offs[params->col]];
-	const char *unquoted = str;
-	if (str[0] == '"')
-		unquoted = csv_unquot(str);
+	const char *unquoted = csv_unquot_buf(str, &params->unquoted,
+			&params->unquoted_size);
 
 	const char *sep = params->separators;
 
@@ -134,9 +136,6 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 
 	fputc('\n', stdout);
 
-	if (str[0] == '"')
-		free((char *)unquoted);
-
 	return 0;
 }
 
@@ -289,6 +288,7 @@ main(int argc, char *argv[])
 
 	free(params.separators);
 	free(params.table);
+	free(params.unquoted);
 
 	return 0;
 }
@@ -52,6 +52,8 @@ struct cb_params {
 
 	size_t table_column;
 	char *table;
+
+	struct csv_values row;
 };
 
 static struct cb_params Params;
@@ -63,6 +65,7 @@ sql_column_done(void)
 	struct rpn_expression exp;
 	exp.tokens = Tokens;
 	exp.count = Ntokens;
+	rpn_prepare(&exp);
 
 	if (!New_name) {
 		fprintf(stderr,
@@ -101,6 +104,7 @@ sql_named_column_done(char *name)
 	struct rpn_expression exp;
 	exp.tokens = Tokens;
 	exp.count = Ntokens;
+	rpn_prepare(&exp);
 
 	if (New_name) {
 		fprintf(stderr,
@@ -141,22 +145,22 @@ sql_all_columns(void)
 }
 
 static void
-process_exp(struct rpn_expression *exp, const char *buf, const size_t *col_offs,
-		char sep)
+process_exp(struct rpn_expression *exp, struct csv_values *row, char sep)
 {
 	struct rpn_variant ret;
 
-	if (rpn_eval(exp, buf, col_offs, &ret))
+	if (rpn_eval(exp, row, &ret))
 		exit(2);
 
 	if (ret.type == RPN_LLONG) {
-		printf("%lld%c", ret.llong, sep);
+		csv_print_int(stdout, ret.llong);
+		fputc(sep, stdout);
 	} else if (ret.type == RPN_PCHAR) {
 		csv_print_quoted(ret.pchar, strlen(ret.pchar));
 		fputc(sep, stdout);
-		free(ret.pchar);
 	} else if (ret.type == RPN_DOUBLE) {
-		printf("%f%c", ret.dbl, sep);
+		csv_print_double(stdout, ret.dbl);
+		fputc(sep, stdout);
 	} else {
 		fprintf(stderr, "unknown type %d\n", ret.type);
 		exit(2);
@@ -187,15 +191,17 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 	csv_print_line(stdout, buf, col_offs, ncols, false);
 	fputc(',', stdout);
 
+	csv_values_set_row(&params->row, buf, col_offs);
+
 	for (size_t i = 0; i < columns->count - 1; ++i) {
 		exp = &columns->col[i].expr;
 
-		process_exp(exp, buf, col_offs, ',');
+		process_exp(exp, &params->row, ',');
 	}
 
 	exp = &columns->col[columns->count - 1].expr;
 
-	process_exp(exp, buf, col_offs, '\n');
+	process_exp(exp, &params->row, '\n');
 
 	return 0;
 }
@@ -333,7 +339,9 @@ main(int argc, char *argv[])
 		describe_column(&columns->col[i], ',', any_str_column_had_type);
 	describe_column(&columns->col[columns->count - 1], '\n', any_str_column_had_type);
 
+	csv_values_init(&Params.row, Nheaders);
 	csv_read_all_nofail(s, &next_row, &Params);
+	csv_values_fini(&Params.row);
 
 	csv_destroy_ctx(s);
 
@@ -55,6 +55,9 @@ struct cb_params {
 
 	size_t table_column;
 	char *table;
+
+	char *unquoted;
+	size_t unquoted_size;
 };
 
 static int
@@ -78,9 +81,8 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 	fputc(',', stdout);
 
 	const char *str = &buf[col_offs[params->col]];
-	const char *unquoted = str;
-	if (str[0] == '"')
-		unquoted = csv_unquot(str);
+	const char *unquoted = csv_unquot_buf(str, &params->unquoted,
+			&params->unquoted_size);
 
 	ssize_t start = params->start_pos;
 	size_t len = params->length;
@@ -89,9 +91,6 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 
 	fputc('\n', stdout);
 
-	if (str[0] == '"')
-		free((char *)unquoted);
-
 	return 0;
 }
 
@@ -201,6 +200,7 @@ main(int argc, char *argv[])
 	csv_destroy_ctx(s);
 
 	free(params.table);
+	free(params.unquoted);
 
 	return 0;
 }
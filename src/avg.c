@@ -63,6 +63,8 @@ struct cb_params {
 
 	size_t table_column;
 	char *table;
+
+	struct csv_values row;
 };
 
 static int
@@ -81,15 +83,17 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 		}
 	}
 
+	csv_values_set_row(&params->row, buf, col_offs);
+
 	for (size_t i = 0; i < params->ncols; ++i) {
 		if (!params->active_cols[i])
 			continue;
 
-		const char *val = &buf[col_offs[params->cols[i]]];
+		size_t col = params->cols[i];
 
 		if (params->types[i] == TYPE_INT) {
 			long long llval;
-			if (strtoll_safe(val, &llval, 0))
+			if (csv_values_int(&params->row, col, &llval))
 				return -1;
 
 			if (llval > 0 && params->sums[i] > LLONG_MAX - llval) {
@@ -105,7 +109,7 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 			params->sums[i] += llval;
 		} else if (params->types[i] == TYPE_FLOAT) {
 			double dbl;
-			if (strtod_safe(val, &dbl))
+			if (csv_values_float(&params->row, col, &dbl))
 				return -1;
 
 			params->dblsums[i] += dbl;
@@ -284,7 +288,9 @@ main(int argc, char *argv[])
 	free(results);
 	results = NULL;
 
+	csv_values_init(&params.row, nheaders);
 	csv_read_all_nofail(s, &next_row, &params);
+	csv_values_fini(&params.row);
 
 	csv_destroy_ctx(s);
 
@@ -297,11 +303,14 @@ main(int argc, char *argv[])
 	for (size_t i = start_idx; i < params.ncols - 1; ++i) {
 		if (params.active_cols[i]) {
 			if (params.types[i] == TYPE_INT) {
-				printf("%lld,", params.rows ? params.sums[i] /
+				csv_print_int(stdout, params.rows ? params.sums[i] /
 						(long long)params.rows : 0);
+				putchar(',');
 			} else if (params.types[i] == TYPE_FLOAT) {
-				printf("%f,", params.rows ? params.dblsums[i] /
+				csv_print_double(stdout, params.rows ?
+						params.dblsums[i] /
 						(double)params.rows : 0);
+				putchar(',');
 			} else {
 				assert(0);
 			}
@@ -312,10 +321,12 @@ main(int argc, char *argv[])
 
 	if (params.active_cols[params.ncols - 1]) {
 		if (params.types[params.ncols - 1] == TYPE_INT) {
-			printf("%lld", params.rows ? params.sums[params.ncols - 1] /
+			csv_print_int(stdout, params.rows ?
+					params.sums[params.ncols - 1] /
 					(long long)params.rows : 0);
 		} else if (params.types[params.ncols - 1] == TYPE_FLOAT) {
-			printf("%f", params.rows ? params.dblsums[params.ncols - 1] /
+			csv_print_double(stdout, params.rows ?
+					params.dblsums[params.ncols - 1] /
 					(double)params.rows : 0);
 		} else {
 			assert(0);
@@ -38,12 +38,29 @@ usage(FILE *out)
 	describe_version(out);
 }
 
+struct cb_params {
+	size_t *idx;
+	bool reordered;
+	struct csv_writer out;
+};
+
 static int
-next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
+next_batch(const struct csv_batch *batch, void *arg)
 {
-	size_t *idx = arg;
-
-	csv_print_line_reordered(stdout, buf, col_offs, ncols, true, idx);
+	struct cb_params *params = arg;
+	size_t ncols = batch->ncols;
+
+	for (size_t r = 0; r < batch->nrows; ++r) {
+		const char *buf = &batch->buf[batch->row_offs[r]];
+		const size_t *col_offs = &batch->col_offs[r * ncols];
+
+		if (params->reordered)
+			csv_writer_line_reordered(&params->out, buf, col_offs,
+					ncols, true, params->idx);
+		else
+			csv_writer_raw_row(&params->out, buf,
+					batch->row_lens[r], col_offs, ncols);
+	}
 
 	return 0;
 }
@@ -52,6 +69,8 @@ struct input {
 	FILE *f;
 	struct csv_ctx *s;
 	size_t *idx;
+	/* columns are in different order than in the first input */
+	bool reordered;
 };
 
 static size_t nheaders;
@@ -105,6 +124,14 @@ add_input(FILE *f, struct input *in, size_t file_idx)
 			in->idx[j] = idx;
 		}
 	}
+
+	in->reordered = false;
+	for (size_t j = 0; j < nheaders; ++j) {
+		if (in->idx[j] != j) {
+			in->reordered = true;
+			break;
+		}
+	}
 }
 
 int
@@ -177,14 +204,21 @@ main(int argc, char *argv[])
 
 	csv_print_headers(stdout, headers, nheaders);
 
+	struct cb_params params;
+	csv_writer_init(&params.out, stdout, CSV_WRITER_DEFAULT_SIZE);
+
 	for (size_t i = 0; i < ninputs; ++i) {
 		struct input *in = &inputs[i];
-		csv_read_all_nofail(in->s, &next_row, in->idx);
+		params.idx = in->idx;
+		params.reordered = in->reordered;
+		csv_read_batches_nofail(in->s, &next_batch, &params);
 		csv_destroy_ctx(in->s);
 		free(in->idx);
 		fclose(in->f);
 	}
 
+	csv_writer_fini(&params.out);
+
 	free(inputs);
 
 	return 0;
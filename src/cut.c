@@ -53,27 +53,23 @@ struct cb_params {
 
 	size_t table_column;
 	char *table;
+
+	struct csv_writer out;
 };
 
 static int
-next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
+next_batch(const struct csv_batch *batch, void *arg)
 {
-	UNUSED(ncols);
 	struct cb_params *params = arg;
 
-	if (params->table) {
-		const char *table = &buf[col_offs[params->table_column]];
-		if (strcmp(table, params->table) != 0) {
-			csv_print_line_reordered(stdout, buf, col_offs,
-					params->ncols, true, params->cols);
+	for (size_t i = 0; i < batch->nrows; ++i) {
+		const char *buf = &batch->buf[batch->row_offs[i]];
+		const size_t *col_offs = &batch->col_offs[i * batch->ncols];
 
-			return 0;
-		}
+		csv_writer_line_reordered(&params->out, buf, col_offs,
+				params->ncols, true, params->cols);
 	}
 
-	csv_print_line_reordered(stdout, buf, col_offs, params->ncols, true,
-			params->cols);
-
 	return 0;
 }
 
@@ -244,7 +240,9 @@ main(int argc, char *argv[])
 		csv_print_header(stdout,
 				&headers[params.cols[params.ncols - 1]], '\n');
 
-		csv_read_all_nofail(s, &next_row, &params);
+		csv_writer_init(&params.out, stdout, CSV_WRITER_DEFAULT_SIZE);
+		csv_read_batches_nofail(s, &next_batch, &params);
+		csv_writer_fini(&params.out);
 	}
 
 	free(params.cols);
@@ -36,6 +36,10 @@ usage(FILE *out)
 struct subst {
 	size_t argv_idx;
 	size_t col;
+
+	/* space for unquoted value, reused between rows */
+	char *unquoted;
+	size_t unquoted_size;
 };
 
 struct cb_params {
@@ -51,6 +55,15 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 	UNUSED(ncols);
 	struct cb_params *params = arg;
 
+	/* done before fork, so that buffers can be reused for the next row */
+	for (size_t i = 0; i < params->nsubsts; ++i) {
+		struct subst *subst = &params->substs[i];
+		const char *d = csv_unquot_buf(&buf[col_offs[subst->col]],
+				&subst->unquoted, &subst->unquoted_size);
+
+		params->argv[subst->argv_idx] = (char *)d;
+	}
+
 	pid_t pid = fork();
 	if (pid < 0) {
 		perror("fork");
@@ -60,15 +73,6 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 	if (pid == 0) {
 		char **argv = params->argv;
 
-		for (size_t i = 0; i < params->nsubsts; ++i) {
-			struct subst *subst = &params->substs[i];
-			char *d = (char *)&buf[col_offs[subst->col]];
-			if (d[0] == '"')
-				d = csv_unquot(d);
-
-			argv[subst->argv_idx] = d;
-		}
-
 		execvp(argv[0], argv);
 		perror("execvp");
 		if (errno == ENOENT)
@@ -160,6 +164,8 @@ main(int argc, char *argv[])
 
 			params.substs[params.nsubsts - 1].argv_idx = idx;
 			params.substs[params.nsubsts - 1].col = col;
+			params.substs[params.nsubsts - 1].unquoted = NULL;
+			params.substs[params.nsubsts - 1].unquoted_size = 0;
 		} else {
 			params.argv[idx] = argv[i];
 		}
@@ -169,6 +175,8 @@ main(int argc, char *argv[])
 
 	csv_destroy_ctx(s);
 
+	for (size_t i = 0; i < params.nsubsts; ++i)
+		free(params.substs[i].unquoted);
 	free(params.substs);
 	free(params.argv);
 
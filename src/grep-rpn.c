@@ -49,36 +49,56 @@ struct cb_params {
 
 	char *table;
 	size_t table_column;
+
+	struct csv_writer out;
+	struct csv_values row;
 };
 
-static int
-next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
+static bool
+row_matches(struct cb_params *params, const char *buf, const size_t *col_offs)
 {
-	struct cb_params *params = arg;
-
-	if (params->table) {
-		const char *table = &buf[col_offs[params->table_column]];
-		if (strcmp(table, params->table) != 0) {
-			csv_print_line(stdout, buf, col_offs, ncols, true);
-
-			return 0;
-		}
-	}
+	csv_values_set_row(&params->row, buf, col_offs);
 
 	for (size_t i = 0; i < params->count; ++i) {
 		struct rpn_expression *exp = &params->expressions[i];
 		struct rpn_variant ret;
 
-		if (rpn_eval(exp, buf, col_offs, &ret))
+		if (rpn_eval(exp, &params->row, &ret))
 			exit(2);
 
 		if (ret.type != RPN_LLONG) /* shouldn't be possible */
 			abort();
 
-		if (ret.llong) {
-			csv_print_line(stdout, buf, col_offs, ncols, true);
-			return 0;
+		if (ret.llong)
+			return true;
+	}
+
+	return false;
+}
+
+static int
+next_batch(const struct csv_batch *batch, void *arg)
+{
+	struct cb_params *params = arg;
+	size_t ncols = batch->ncols;
+
+	for (size_t r = 0; r < batch->nrows; ++r) {
+		const char *buf = &batch->buf[batch->row_offs[r]];
+		const size_t *col_offs = &batch->col_offs[r * ncols];
+
+		if (params->table) {
+			const char *table = &buf[col_offs[params->table_column]];
+			if (strcmp(table, params->table) != 0) {
+				csv_writer_raw_row(&params->out, buf,
+						batch->row_lens[r], col_offs,
+						ncols);
+				continue;
+			}
 		}
+
+		if (row_matches(params, buf, col_offs))
+			csv_writer_raw_row(&params->out, buf,
+					batch->row_lens[r], col_offs, ncols);
 	}
 
 	return 0;
@@ -176,7 +196,11 @@ main(int argc, char *argv[])
 
 	csv_print_headers(stdout, headers, nheaders);
 
-	csv_read_all_nofail(s, &next_row, &params);
+	csv_writer_init(&params.out, stdout, CSV_WRITER_DEFAULT_SIZE);
+	csv_values_init(&params.row, nheaders);
+	csv_read_batches_nofail(s, &next_batch, &params);
+	csv_values_fini(&params.row);
+	csv_writer_fini(&params.out);
 
 	csv_destroy_ctx(s);
 
@@ -50,6 +50,8 @@ struct cb_params {
 
 	char *table;
 	size_t table_column;
+
+	struct csv_values row;
 };
 
 #include "sql-shared.h"
@@ -68,11 +70,13 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 		}
 	}
 
+	csv_values_set_row(&params->row, buf, col_offs);
+
 	for (size_t i = 0; i < params->count; ++i) {
 		struct rpn_expression *exp = &params->expressions[i];
 		struct rpn_variant ret;
 
-		if (rpn_eval(exp, buf, col_offs, &ret))
+		if (rpn_eval(exp, &params->row, &ret))
 			exit(2);
 
 		if (ret.type != RPN_LLONG) /* shouldn't be possible */
@@ -181,6 +185,7 @@ main(int argc, char *argv[])
 
 		exp->tokens = Tokens;
 		exp->count = Ntokens;
+		rpn_prepare(exp);
 
 		Tokens = NULL;
 		Ntokens = 0;
@@ -198,7 +203,9 @@ main(int argc, char *argv[])
 
 	csv_print_headers(stdout, Headers, Nheaders);
 
+	csv_values_init(&params.row, Nheaders);
 	csv_read_all_nofail(s, &next_row, &params);
+	csv_values_fini(&params.row);
 
 	csv_destroy_ctx(s);
 
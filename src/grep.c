@@ -6,7 +6,6 @@
 
 #include <getopt.h>
 #include <locale.h>
-#include <regex.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -14,6 +13,7 @@
 #include <string.h>
 
 #include "parse.h"
+#include "regex_cache.h"
 #include "utils.h"
 
 static const struct option opts[] = {
@@ -63,9 +63,11 @@ struct condition {
 	bool whole;
 	enum {csv_match_regexp, csv_match_eregexp, csv_match_string} type;
 	size_t col_num;
-	regex_t preg;
+	struct csv_regex preg;
 };
 
+enum row_state { UNDECIDED, PRINT, OMIT };
+
 struct cb_params {
 	struct condition *conditions;
 	size_t nconditions;
@@ -73,13 +75,21 @@ struct cb_params {
 
 	char *table;
 	size_t table_column;
+
+	enum row_state *row_states;
+	size_t nrow_states;
+
+	char *unquoted;
+	size_t unquoted_size;
+
+	struct csv_writer out;
 };
 
 static bool
 matches(const char *str, const struct condition *c)
 {
 	if (c->type != csv_match_string)
-		return regexec(&c->preg, str, 0, NULL, 0) == 0;
+		return csv_regex_exec(&c->preg, str, 0, NULL) == 0;
 
 	bool ret;
 	if (c->whole) {
@@ -99,66 +109,78 @@ matches(const char *str, const struct condition *c)
 	return ret;
 }
 
+static bool
+matches_value(struct cb_params *params, const char *val,
+		const struct condition *c)
+{
+	return matches(csv_unquot_buf(val, &params->unquoted,
+			&params->unquoted_size), c);
+}
+
 static int
-next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
+next_batch(const struct csv_batch *batch, void *arg)
 {
 	struct cb_params *params = arg;
 	struct condition *conditions = params->conditions;
 	size_t nconditions = params->nconditions;
 	bool invert = params->invert;
+	size_t nrows = batch->nrows;
+	size_t ncols = batch->ncols;
 
-	if (params->table) {
-		const char *table = &buf[col_offs[params->table_column]];
-		if (strcmp(table, params->table) != 0) {
-			csv_print_line(stdout, buf, col_offs, ncols, true);
-
-			return 0;
-		}
+	if (nrows > params->nrow_states) {
+		params->row_states = xrealloc_nofail(params->row_states, nrows,
+				sizeof(params->row_states[0]));
+		params->nrow_states = nrows;
 	}
 
-	if (invert) {
-		// !AA && !BB && !CC -> AA || BB || CC
-		for (size_t i = 0; i < nconditions; ++i) {
-			const struct condition *c = &conditions[i];
-			const char *val = &buf[col_offs[c->col_num]];
-			const char *unquoted = val;
-			bool omit;
-
-			if (val[0] == '"')
-				unquoted = csv_unquot(val);
+	enum row_state *states = params->row_states;
+	for (size_t r = 0; r < nrows; ++r)
+		states[r] = UNDECIDED;
 
-			omit = matches(unquoted, c);
-
-			if (val[0] == '"')
-				free((char *)unquoted);
+	if (params->table) {
+		for (size_t r = 0; r < nrows; ++r) {
+			const char *buf = &batch->buf[batch->row_offs[r]];
+			const size_t *col_offs = &batch->col_offs[r * ncols];
+			const char *table = &buf[col_offs[params->table_column]];
 
-			if (omit)
-				return 0;
+			if (strcmp(table, params->table) != 0)
+				states[r] = PRINT;
 		}
-	} else {
-		// AA || BB || CC -> !AA && !BB && !CC
-		size_t numfalse = 0;
-		for (size_t i = 0; i < nconditions; ++i) {
-			const struct condition *c = &conditions[i];
-			const char *val = &buf[col_offs[c->col_num]];
-			const char *unquoted = val;
+	}
+
+	/*
+	 * Evaluate one condition for all rows at a time.
+	 *
+	 * normal: AA || BB || CC - first match decides that row is printed
+	 * invert: !AA && !BB && !CC - first match decides that row is omitted
+	 */
+	for (size_t i = 0; i < nconditions; ++i) {
+		const struct condition *c = &conditions[i];
 
-			if (val[0] == '"')
-				unquoted = csv_unquot(val);
+		for (size_t r = 0; r < nrows; ++r) {
+			if (states[r] != UNDECIDED)
+				continue;
 
-			if (!matches(unquoted, c))
-				numfalse++;
+			const char *buf = &batch->buf[batch->row_offs[r]];
+			const size_t *col_offs = &batch->col_offs[r * ncols];
 
-			if (val[0] == '"')
-				free((char *)unquoted);
+			if (matches_value(params, &buf[col_offs[c->col_num]],
+					c))
+				states[r] = invert ? OMIT : PRINT;
 		}
-
-		if (numfalse == nconditions)
-			return 0;
 	}
 
+	for (size_t r = 0; r < nrows; ++r) {
+		if (states[r] == OMIT)
+			continue;
+		if (states[r] == UNDECIDED && !invert)
+			continue;
 
-	csv_print_line(stdout, buf, col_offs, ncols, true);
+		csv_writer_raw_row(&params->out,
+				&batch->buf[batch->row_offs[r]],
+				batch->row_lens[r],
+				&batch->col_offs[r * ncols], ncols);
+	}
 
 	return 0;
 }
@@ -197,6 +219,10 @@ main(int argc, char *argv[])
 	setlocale(LC_NUMERIC, "C");
 
 	params.table = NULL;
+	params.row_states = NULL;
+	params.nrow_states = 0;
+	params.unquoted = NULL;
+	params.unquoted_size = 0;
 
 	while ((opt = getopt_long(argc, argv, "c:e:E:F:isST:vx", opts,
 			NULL)) != -1) {
@@ -332,18 +358,12 @@ main(int argc, char *argv[])
 			}
 		}
 
-		int ret = regcomp(&c->preg, pattern,
+		int ret = csv_regex_compile(&c->preg, pattern,
 				REG_NOSUB |
 				(c->ignore_case ? REG_ICASE : 0) |
 				(c->type == csv_match_eregexp ? REG_EXTENDED : 0));
 		if (ret) {
-			size_t len = regerror(ret, &c->preg, NULL, 0);
-			char *errbuf = xmalloc_nofail(len, 1);
-			regerror(ret, &c->preg, errbuf, len);
-			fprintf(stderr,
-				"compilation of expression '%s' failed: %s\n",
-				pattern, errbuf);
-			free(errbuf);
+			csv_regex_print_error(ret, &c->preg, pattern);
 			exit(2);
 		}
 
@@ -357,7 +377,18 @@ main(int argc, char *argv[])
 	params.nconditions = nconditions;
 	params.invert = invert;
 
-	csv_read_all_nofail(s, &next_row, &params);
+	size_t *needed = xmalloc_nofail(nconditions + 1, sizeof(needed[0]));
+	size_t nneeded = 0;
+	for (size_t i = 0; i < nconditions; ++i)
+		needed[nneeded++] = conditions[i].col_num;
+	if (params.table)
+		needed[nneeded++] = params.table_column;
+	csv_set_needed_columns_nofail(s, needed, nneeded, true);
+	free(needed);
+
+	csv_writer_init(&params.out, stdout, CSV_WRITER_DEFAULT_SIZE);
+	csv_read_batches_nofail(s, &next_batch, &params);
+	csv_writer_fini(&params.out);
 
 	for (size_t i = 0; i < nconditions; ++i) {
 		struct condition *c = &conditions[i];
@@ -365,11 +396,13 @@ main(int argc, char *argv[])
 		free(c->column);
 		free(c->value);
 		if (c->type != csv_match_string)
-			regfree(&conditions[i].preg);
+			csv_regex_free(&conditions[i].preg);
 	}
 
 	free(conditions);
 	free(params.table);
+	free(params.row_states);
+	free(params.unquoted);
 
 	csv_destroy_ctx(s);
 
@@ -41,18 +41,25 @@ usage(FILE *out)
 struct cb_params {
 	size_t lines;
 	size_t printed;
+
+	struct csv_writer out;
 };
 
 static int
-next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
+next_batch(const struct csv_batch *batch, void *arg)
 {
 	struct cb_params *params = arg;
 
-	if (params->printed >= params->lines)
-		return 1;
-	params->printed++;
+	for (size_t r = 0; r < batch->nrows; ++r) {
+		if (params->printed >= params->lines)
+			return 1;
+		params->printed++;
 
-	csv_print_line(stdout, buf, col_offs, ncols, true);
+		csv_writer_raw_row(&params->out, &batch->buf[batch->row_offs[r]],
+				batch->row_lens[r],
+				&batch->col_offs[r * batch->ncols],
+				batch->ncols);
+	}
 
 	return 0;
 }
@@ -100,8 +107,10 @@ main(int argc, char *argv[])
 
 	csv_print_headers(stdout, headers, nheaders);
 
-	if (csv_read_all(s, &next_row, &params) < 0)
+	csv_writer_init(&params.out, stdout, CSV_WRITER_DEFAULT_SIZE);
+	if (csv_read_batches(s, &next_batch, &params) < 0)
 		exit(2);
+	csv_writer_fini(&params.out);
 
 	csv_destroy_ctx(s);
 
@@ -344,8 +344,6 @@ main(int argc, char *argv[])
 		for (size_t i = 0; i < lines->used; ++i) {
 			struct line *line = &lines->data[i];
 			csv_print_line(stdout, line->buf, line->col_offs, nheaders, true);
-
-			lines_free_one(line);
 		}
 		lines_fini(lines);
 
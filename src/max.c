@@ -65,6 +65,8 @@ struct cb_params {
 
 	size_t table_column;
 	char *table;
+
+	struct csv_values row;
 };
 
 static int
@@ -83,30 +85,30 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 		}
 	}
 
+	csv_values_set_row(&params->row, buf, col_offs);
+
 	for (size_t i = 0; i < params->ncols; ++i) {
 		if (!params->active_cols[i])
 			continue;
 
-		const char *val = &buf[col_offs[params->cols[i]]];
+		size_t col = params->cols[i];
 
 		if (params->types[i] == TYPE_INT) {
 			long long llval;
-			if (strtoll_safe(val, &llval, 0))
+			if (csv_values_int(&params->row, col, &llval))
 				return -1;
 
 			if (llval > params->max_int[i])
 				params->max_int[i] = llval;
 		} else if (params->types[i] == TYPE_FLOAT) {
 			double dbl;
-			if (strtod_safe(val, &dbl))
+			if (csv_values_float(&params->row, col, &dbl))
 				return -1;
 
 			if (dbl > params->max_dbl[i])
 				params->max_dbl[i] = dbl;
 		} else {
-			const char *unquoted = val;
-			if (val[0] == '"')
-				unquoted = csv_unquot(val);
+			const char *unquoted = csv_values_str(&params->row, col);
 
 			if (params->max_str[i] == NULL ||
 					strcmp(unquoted, params->max_str[i]) > 0) {
@@ -118,9 +120,6 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 				}
 				memcpy(params->max_str[i], unquoted, len + 1);
 			}
-
-			if (val[0] == '"')
-				free((char *)unquoted);
 		}
 	}
 
@@ -312,7 +311,9 @@ main(int argc, char *argv[])
 	free(results);
 	results = NULL;
 
+	csv_values_init(&params.row, nheaders);
 	csv_read_all_nofail(s, &next_row, &params);
+	csv_values_fini(&params.row);
 
 	csv_destroy_ctx(s);
 
@@ -326,9 +327,11 @@ main(int argc, char *argv[])
 		if (!params.active_cols[i]) {
 			putchar(',');
 		} else if (params.types[i] == TYPE_INT) {
-			printf("%lld,", params.max_int[i]);
+			csv_print_int(stdout, params.max_int[i]);
+			putchar(',');
 		} else if (params.types[i] == TYPE_FLOAT) {
-			printf("%f,", params.max_dbl[i]);
+			csv_print_double(stdout, params.max_dbl[i]);
+			putchar(',');
 		} else {
 			csv_print_quoted(params.max_str[i],
 					strlen(params.max_str[i]));
@@ -339,9 +342,9 @@ main(int argc, char *argv[])
 	size_t idx = params.ncols - 1;
 	if (params.active_cols[idx]) {
 		if (params.types[idx] == TYPE_INT)
-			printf("%lld", params.max_int[idx]);
+			csv_print_int(stdout, params.max_int[idx]);
 		else if (params.types[idx] == TYPE_FLOAT)
-			printf("%f", params.max_dbl[idx]);
+			csv_print_double(stdout, params.max_dbl[idx]);
 		else
 			csv_print_quoted(params.max_str[idx],
 					strlen(params.max_str[idx]));
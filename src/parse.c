@@ -9,10 +9,29 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "parse.h"
+#include "scan.h"
 #include "utils.h"
 
+#ifdef C11THREADS_ENABLED
+#include "thread_utils.h"
+#endif
+
+#define DEFAULT_BUFFER_SIZE (256 * 1024)
+
+/* columns callbacks are interested in, see csv_set_needed_columns */
+struct projection {
+	size_t *cols;
+	size_t ncols;
+	/* the last needed column */
+	size_t last;
+	bool whole_rows;
+};
+
 struct csv_ctx {
 	FILE *in;
 	FILE *err;
@@ -22,8 +41,396 @@ struct csv_ctx {
 
 	struct col_header *headers;
 	size_t nheaders;
+
+	/* input buffer */
+	char *buf;
+	size_t buf_size;
+	/* offset of the first byte which wasn't consumed yet */
+	size_t buf_start;
+	/* number of valid bytes in the buffer */
+	size_t buf_ready;
+	bool eof;
+
+	/* buf points to a read-only mapping of the input file */
+	bool mapped;
+
+	/*
+	 * configured size of the input buffer, also the amount of mapped
+	 * input parsed by one thread at a time
+	 */
+	size_t chunk_size;
+
+	/* number of bytes read so far (not used for mapped input) */
+	size_t total_read;
+	/* csv_read_batches is running */
+	bool reading_rows;
+
+	struct projection *proj;
+
+#ifdef C11THREADS_ENABLED
+	struct readahead *ra;
+#endif
 };
 
+static int
+get_buffer_size(FILE *err, size_t *buf_size)
+{
+	const char *env = getenv("CSVNIXTOOLS_BUFFER_SIZE");
+	if (!env) {
+		*buf_size = DEFAULT_BUFFER_SIZE;
+		return 0;
+	}
+
+	char *end;
+	errno = 0;
+	unsigned long long size = strtoull(env, &end, 0);
+	if (errno || end == env || env[0] == '-')
+		goto invalid;
+
+	unsigned long long mul = 1;
+	if (*end == 'k' || *end == 'K')
+		mul = 1024;
+	else if (*end == 'm' || *end == 'M')
+		mul = 1024 * 1024;
+
+	if (mul != 1)
+		end++;
+
+	if (*end || size == 0 || size > SIZE_MAX / 2 / mul)
+		goto invalid;
+
+	*buf_size = (size_t)(size * mul);
+	return 0;
+
+invalid:
+	fprintf(err, "invalid CSVNIXTOOLS_BUFFER_SIZE '%s'\n", env);
+	return -1;
+}
+
+/*
+ * If input is a regular file, map it and let the parser work directly on
+ * the mapping. Otherwise (pipes, terminals, mmap failures) input will be
+ * read into a buffer.
+ */
+static void
+map_input(struct csv_ctx *ctx)
+{
+	const char *env = getenv("CSVNIXTOOLS_MMAP");
+	if (env && strcmp(env, "0") == 0)
+		return;
+
+	int fd = fileno(ctx->in);
+	if (fd < 0)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode))
+		return;
+
+	off_t pos = lseek(fd, 0, SEEK_CUR);
+	if (pos < 0 || pos >= st.st_size)
+		return;
+
+	if ((unsigned long long)st.st_size > SIZE_MAX)
+		return;
+
+	long page_size = sysconf(_SC_PAGESIZE);
+	if (page_size <= 0)
+		return;
+
+	off_t map_start = pos - pos % page_size;
+	size_t len = (size_t)(st.st_size - map_start);
+
+	void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, map_start);
+	if (map == MAP_FAILED)
+		return;
+
+	madvise(map, len, MADV_SEQUENTIAL);
+
+	ctx->buf = map;
+	ctx->buf_size = len;
+	ctx->buf_ready = len;
+	/* mapping must start at page boundary */
+	ctx->buf_start = (size_t)(pos - map_start);
+	ctx->mapped = true;
+	ctx->eof = true;
+}
+
+#ifdef C11THREADS_ENABLED
+
+/*
+ * Read-ahead thread.
+ *
+ * When input turns out to be big, a thread which reads the next part of
+ * the input while the current one is parsed is started. There are two
+ * buffers - one is owned by the parser and the other one by the reader.
+ * Reader puts data after the first READAHEAD_HEADROOM bytes of its buffer,
+ * so when buffers are swapped the unconsumed end of the current buffer
+ * (usually a part of a row) can be copied in front of the new data.
+ */
+
+#define READAHEAD_HEADROOM(ctx) ((ctx)->chunk_size)
+
+struct readahead {
+	int fd;
+	size_t headroom;
+
+	/* buffer waiting to be filled */
+	char *empty;
+	size_t empty_size;
+
+	/* buffer filled by the reader */
+	char *full;
+	size_t full_size;
+	ssize_t nread;
+	int error;
+
+	/* reader is in read(2), without any lock held */
+	bool reading;
+	/* stop was requested */
+	bool stop;
+	/* context was destroyed while reader was in read(2) */
+	bool abandoned;
+
+	mtx_t mtx;
+	cnd_t cnd;
+	thrd_t thrd;
+};
+
+static void
+readahead_free(struct readahead *ra)
+{
+	cnd_destroy(&ra->cnd);
+	mtx_destroy(&ra->mtx);
+	free(ra->empty);
+	free(ra->full);
+	free(ra);
+}
+
+static int
+readahead_thread(void *arg)
+{
+	struct readahead *ra = arg;
+	bool abandoned = false;
+
+	mtx_lock_nofail(&ra->mtx);
+	while (1) {
+		while (!ra->stop && !ra->empty)
+			cnd_wait_nofail(&ra->cnd, &ra->mtx);
+
+		if (ra->stop)
+			break;
+
+		char *buf = ra->empty;
+		size_t size = ra->empty_size;
+		ra->empty = NULL;
+		ra->reading = true;
+		mtx_unlock_nofail(&ra->mtx);
+
+		ssize_t readin;
+		do {
+			readin = read(ra->fd, &buf[ra->headroom],
+					size - ra->headroom);
+		} while (readin < 0 && errno == EINTR);
+		int error = errno;
+
+		mtx_lock_nofail(&ra->mtx);
+		ra->reading = false;
+
+		if (ra->abandoned) {
+			free(buf);
+			abandoned = true;
+			break;
+		}
+
+		ra->full = buf;
+		ra->full_size = size;
+		ra->nread = readin;
+		ra->error = readin < 0 ? error : 0;
+		cnd_broadcast_nofail(&ra->cnd);
+
+		if (readin <= 0)
+			break;
+	}
+	mtx_unlock_nofail(&ra->mtx);
+
+	if (abandoned)
+		readahead_free(ra);
+
+	return 0;
+}
+
+static bool
+readahead_enabled(void)
+{
+	const char *env = getenv("CSVNIXTOOLS_READAHEAD");
+
+	return !env || strcmp(env, "0") != 0;
+}
+
+static int
+start_readahead(struct csv_ctx *ctx)
+{
+	struct readahead *ra = calloc(1, sizeof(*ra));
+	if (!ra) {
+		fprintf(ctx->err, "calloc: %s\n", strerror(errno));
+		return -1;
+	}
+
+	ra->fd = fileno(ctx->in);
+	ra->headroom = READAHEAD_HEADROOM(ctx);
+	ra->empty_size = ra->headroom + ctx->chunk_size;
+	ra->empty = malloc(ra->empty_size);
+	if (!ra->empty) {
+		fprintf(ctx->err, "malloc: %s\n", strerror(errno));
+		free(ra);
+		return -1;
+	}
+
+	mtx_init_nofail(&ra->mtx, mtx_plain);
+	cnd_init_nofail(&ra->cnd);
+	thrd_create_nofail(&ra->thrd, readahead_thread, ra);
+
+	ctx->ra = ra;
+
+	return 0;
+}
+
+static void
+stop_readahead(struct csv_ctx *ctx)
+{
+	struct readahead *ra = ctx->ra;
+
+	mtx_lock_nofail(&ra->mtx);
+	if (ra->reading) {
+		/*
+		 * Reader may wait for data forever (e.g. on terminal or pipe),
+		 * so don't wait for it. It will clean up after itself.
+		 */
+		ra->abandoned = true;
+		mtx_unlock_nofail(&ra->mtx);
+		thrd_detach(ra->thrd);
+	} else {
+		ra->stop = true;
+		cnd_broadcast_nofail(&ra->cnd);
+		mtx_unlock_nofail(&ra->mtx);
+		thrd_join_nofail(ra->thrd, NULL);
+		readahead_free(ra);
+	}
+
+	ctx->ra = NULL;
+}
+
+/* Hands buffer to the reader. */
+static int
+give_buffer(struct csv_ctx *ctx, char *buf, size_t size)
+{
+	struct readahead *ra = ctx->ra;
+
+	if (size < ra->headroom + ctx->chunk_size) {
+		free(buf);
+		size = ra->headroom + ctx->chunk_size;
+		buf = malloc(size);
+		if (!buf) {
+			fprintf(ctx->err, "malloc: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+
+	mtx_lock_nofail(&ra->mtx);
+	ra->empty = buf;
+	ra->empty_size = size;
+	cnd_broadcast_nofail(&ra->cnd);
+	mtx_unlock_nofail(&ra->mtx);
+
+	return 0;
+}
+
+/* Equivalent of refill, which takes data from the read-ahead thread. */
+static ssize_t
+refill_readahead(struct csv_ctx *ctx)
+{
+	struct readahead *ra = ctx->ra;
+
+	mtx_lock_nofail(&ra->mtx);
+	while (!ra->full)
+		cnd_wait_nofail(&ra->cnd, &ra->mtx);
+
+	char *full = ra->full;
+	size_t full_size = ra->full_size;
+	ssize_t readin = ra->nread;
+	int error = ra->error;
+	ra->full = NULL;
+	mtx_unlock_nofail(&ra->mtx);
+
+	if (readin <= 0) {
+		/* reader is done, let stop_readahead free the buffer */
+		ra->empty = full;
+		ra->empty_size = full_size;
+
+		if (readin < 0) {
+			fprintf(ctx->err, "read: %s\n", strerror(error));
+			return -1;
+		}
+
+		ctx->eof = true;
+		return 0;
+	}
+
+	char *data = &full[ra->headroom];
+	size_t len = (size_t)readin;
+	size_t tail = ctx->buf_ready - ctx->buf_start;
+
+	if (tail <= ra->headroom) {
+		/* copy what's left in front of the new data and swap buffers */
+		memcpy(data - tail, &ctx->buf[ctx->buf_start], tail);
+
+		if (give_buffer(ctx, ctx->buf, ctx->buf_size)) {
+			free(full);
+			return -1;
+		}
+
+		ctx->buf = full;
+		ctx->buf_size = full_size;
+		ctx->buf_start = ra->headroom - tail;
+		ctx->buf_ready = ra->headroom + len;
+
+		return readin;
+	}
+
+	/* row longer than headroom - collect it in the current buffer */
+	if (ctx->buf_start > 0) {
+		memmove(&ctx->buf[0], &ctx->buf[ctx->buf_start], tail);
+		ctx->buf_ready = tail;
+		ctx->buf_start = 0;
+	}
+
+	if (ctx->buf_size - ctx->buf_ready < len) {
+		size_t size = ctx->buf_size * 2;
+		while (size - ctx->buf_ready < len)
+			size *= 2;
+
+		char *buf = realloc(ctx->buf, size);
+		if (!buf) {
+			fprintf(ctx->err, "realloc: %s\n", strerror(errno));
+			free(full);
+			return -1;
+		}
+		ctx->buf = buf;
+		ctx->buf_size = size;
+	}
+
+	memcpy(&ctx->buf[ctx->buf_ready], data, len);
+	ctx->buf_ready += len;
+
+	if (give_buffer(ctx, full, full_size))
+		return -1;
+
+	return readin;
+}
+
+#endif
+
 struct csv_ctx *
 csv_create_ctx(FILE *in, FILE *err)
 {
@@ -32,6 +439,15 @@ csv_create_ctx(FILE *in, FILE *err)
 		return NULL;
 	s->in = in;
 	s->err = err;
+	if (get_buffer_size(err, &s->buf_size)) {
+		free(s);
+		return NULL;
+	}
+	s->chunk_size = s->buf_size;
+
+	map_input(s);
+
+	csv_scan_init();
 
 	return s;
 }
@@ -48,8 +464,20 @@ csv_create_ctx_nofail(FILE *in, FILE *err)
 void
 csv_destroy_ctx(struct csv_ctx *ctx)
 {
+#ifdef C11THREADS_ENABLED
+	if (ctx->ra)
+		stop_readahead(ctx);
+#endif
 	free(ctx->header_line);
 	free(ctx->headers);
+	if (ctx->proj) {
+		free(ctx->proj->cols);
+		free(ctx->proj);
+	}
+	if (ctx->mapped)
+		munmap(ctx->buf, ctx->buf_size);
+	else
+		free(ctx->buf);
 	memset(ctx, 0, sizeof(*ctx));
 	free(ctx);
 }
@@ -124,22 +552,121 @@ csv_parse_header(struct csv_ctx *ctx)
 	return add_header(ctx, start);
 }
 
+/*
+ * Reads more data into the input buffer. Data which was already consumed
+ * is discarded and the buffer grows if it's full.
+ *
+ * Returns number of bytes read, 0 on EOF and -1 on error.
+ */
+static ssize_t
+refill(struct csv_ctx *ctx)
+{
+	if (ctx->eof)
+		return 0;
+
+#ifdef C11THREADS_ENABLED
+	if (ctx->ra)
+		return refill_readahead(ctx);
+#endif
+
+	if (ctx->buf_start > 0) {
+		memmove(&ctx->buf[0], &ctx->buf[ctx->buf_start],
+				ctx->buf_ready - ctx->buf_start);
+		ctx->buf_ready -= ctx->buf_start;
+		ctx->buf_start = 0;
+	}
+
+	if (!ctx->buf || ctx->buf_ready == ctx->buf_size) {
+		size_t size = ctx->buf ? ctx->buf_size * 2 : ctx->buf_size;
+		char *buf = realloc(ctx->buf, size);
+		if (!buf) {
+			fprintf(ctx->err, "realloc: %s\n", strerror(errno));
+			return -1;
+		}
+		ctx->buf = buf;
+		ctx->buf_size = size;
+	}
+
+	ssize_t readin;
+	do {
+		readin = read(fileno(ctx->in), &ctx->buf[ctx->buf_ready],
+				ctx->buf_size - ctx->buf_ready);
+	} while (readin < 0 && errno == EINTR);
+
+	if (readin < 0) {
+		fprintf(ctx->err, "read: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (readin == 0)
+		ctx->eof = true;
+
+	ctx->buf_ready += (size_t)readin;
+	ctx->total_read += (size_t)readin;
+
+#ifdef C11THREADS_ENABLED
+	/*
+	 * Input is big, so it's worth reading the rest in the background.
+	 * Don't do that before rows are requested, because some tools fork
+	 * after reading the header (see csv_show).
+	 */
+	if (ctx->reading_rows && !ctx->eof &&
+			ctx->total_read > ctx->chunk_size &&
+			readahead_enabled()) {
+		if (start_readahead(ctx))
+			return -1;
+	}
+#endif
+
+	return readin;
+}
+
 int
 csv_read_header(struct csv_ctx *ctx)
 {
-	ssize_t line_len;
+	char *nl = NULL;
+	size_t scanned = 0;
 
-	errno = 0;
-	line_len = getline(&ctx->header_line, &ctx->header_line_size, ctx->in);
-	if (line_len < 1) {
-		if (errno)
-			fprintf(ctx->err, "getline: %s\n", strerror(errno));
-		else if (feof(ctx->in))
-			fprintf(ctx->err, "EOF while reading header\n");
-		else
-			fprintf(ctx->err, "unrecognized error from getline: %ld\n", line_len);
+	while (1) {
+		size_t avail = ctx->buf_ready - ctx->buf_start;
+
+		if (avail > scanned) {
+			nl = memchr(&ctx->buf[ctx->buf_start + scanned], '\n',
+					avail - scanned);
+			if (nl)
+				break;
+			scanned = avail;
+		}
+
+		ssize_t readin = refill(ctx);
+		if (readin < 0)
+			return -1;
+
+		if (readin == 0) {
+			if (avail == 0) {
+				fprintf(ctx->err, "EOF while reading header\n");
+				return -1;
+			}
+
+			/* let csv_parse_header complain about missing new line */
+			break;
+		}
+	}
+
+	char *start = &ctx->buf[ctx->buf_start];
+	size_t len = nl ? (size_t)(nl - start) + 1 :
+			ctx->buf_ready - ctx->buf_start;
+
+	free(ctx->header_line);
+	ctx->header_line = malloc(len + 1);
+	if (!ctx->header_line) {
+		fprintf(ctx->err, "malloc: %s\n", strerror(errno));
 		return -1;
 	}
+	memcpy(ctx->header_line, start, len);
+	ctx->header_line[len] = 0;
+	ctx->header_line_size = len + 1;
+	ctx->buf_start += len;
 
 	return csv_parse_header(ctx);
 }
@@ -159,139 +686,884 @@ csv_get_headers(struct csv_ctx *ctx, const struct col_header **headers)
 }
 
 int
-csv_read_all(struct csv_ctx *ctx, csv_row_cb cb, void *arg)
+csv_set_needed_columns(struct csv_ctx *ctx, const size_t *cols, size_t ncols,
+		bool whole_rows)
 {
-	size_t *col_offs = malloc(ctx->nheaders * sizeof(col_offs[0]));
-	if (!col_offs) {
+	struct projection *proj = malloc(sizeof(*proj));
+	if (!proj) {
 		fprintf(ctx->err, "malloc: %s\n", strerror(errno));
 		return -1;
 	}
 
-	int ret = 0;
-	int eof = 0;
-	size_t buflen = 0;
-	char *buf = NULL;
-	size_t ready = 0;
+	proj->cols = malloc(ncols * sizeof(cols[0]));
+	if (!proj->cols) {
+		fprintf(ctx->err, "malloc: %s\n", strerror(errno));
+		free(proj);
+		return -1;
+	}
 
-	size_t column = 0;
-	bool in_quoted_string = false;
-	bool last_char_was_quot = false;
-	col_offs[0] = 0;
-	size_t start_off = 0;
+	proj->last = 0;
+	for (size_t i = 0; i < ncols; ++i) {
+		if (cols[i] >= ctx->nheaders) {
+			fprintf(ctx->err, "column %zu doesn't exist\n", cols[i]);
+			free(proj->cols);
+			free(proj);
+			return -1;
+		}
 
-	while (1) {
-		size_t i = start_off;
-		while (i < ready) {
-			if (last_char_was_quot) {
-				if (buf[i] == '"') {
-					// this character was escaped
+		proj->cols[i] = cols[i];
+		if (cols[i] > proj->last)
+			proj->last = cols[i];
+	}
+	proj->ncols = ncols;
+	proj->whole_rows = whole_rows;
+
+	if (ctx->proj) {
+		free(ctx->proj->cols);
+		free(ctx->proj);
+	}
+	ctx->proj = proj;
+
+	return 0;
+}
 
-					// so switch back to in_quot_string logic
-					last_char_was_quot = false;
+void
+csv_set_needed_columns_nofail(struct csv_ctx *ctx, const size_t *cols,
+		size_t ncols, bool whole_rows)
+{
+	if (csv_set_needed_columns(ctx, cols, ncols, whole_rows))
+		exit(2);
+}
 
-					// and continue from the next character
-					i++;
-				} else {
-					// last " was end of quoted string
+#define BATCH_ROWS 256
 
-					// so reset quoting logic
-					last_char_was_quot = false;
-					in_quoted_string = false;
+/* returned by skip_column when the stream is corrupted */
+#define PARSE_ERROR SIZE_MAX
 
-					// and continue from the *same* character
-				}
-			} else if (in_quoted_string) {
-				if (buf[i] == '"')
-					last_char_was_quot = true;
+struct parse_state {
+	bool in_quoted_string;
+	bool last_char_was_quot;
+};
 
-				i++;
-			} else if (buf[i] == ',' || buf[i] == '\n') {
-				// end of non-quoted column
-				buf[i] = 0;
-				column++;
-				if (column == ctx->nheaders) {
-					if (cb(buf, col_offs, ctx->nheaders, arg)) {
-						ret = 1;
-						goto end;
-					}
-
-					i++;
-					memmove(&buf[0], &buf[i], ready - i);
-					ready -= i;
-					i = 0;
-					column = 0;
-				} else {
-					// move on to the next column
-					i++;
-					col_offs[column] = i;
-				}
-			} else if (buf[i] == '"') {
-				// if we are not at the beginning of
-				// a column, then the stream is corrupted
-				if (i != col_offs[column]) {
-					fprintf(ctx->err,
-						"corrupted stream - \" in the middle of unquoted string\n");
-					ret = -1;
-					goto end;
-				}
+/*
+ * Skips over the contents of a column which starts at buf[col_start].
+ * Returns index of the comma or new line character which ends it, end when
+ * more data is needed or PARSE_ERROR if " was found in the middle of
+ * unquoted column.
+ */
+static inline size_t
+skip_column(const char *buf, size_t i, size_t end, struct parse_state *st,
+		size_t col_start)
+{
+	while (i < end) {
+		if (st->last_char_was_quot) {
+			if (buf[i] == '"') {
+				// this character was escaped
 
-				// switch to quoted string logic
-				in_quoted_string = true;
+				// so switch back to in_quot_string logic
+				st->last_char_was_quot = false;
 
 				// and continue from the next character
 				i++;
 			} else {
-				// we are in the middle of a column
+				// last " was end of quoted string
+
+				// so reset quoting logic
+				st->last_char_was_quot = false;
+				st->in_quoted_string = false;
+
+				// and continue from the *same* character
+			}
+		} else if (st->in_quoted_string) {
+			// skip to the next "
+			i = csv_scan_quoted(buf, i, end);
+			if (i < end) {
+				st->last_char_was_quot = true;
 				i++;
 			}
+		} else if (buf[i] == ',' || buf[i] == '\n') {
+			// end of non-quoted column
+			return i;
+		} else if (buf[i] == '"') {
+			// if we are not at the beginning of
+			// a column, then the stream is corrupted
+			if (i != col_start)
+				return PARSE_ERROR;
+
+			// switch to quoted string logic
+			st->in_quoted_string = true;
+
+			// and continue from the next character
+			i++;
+		} else {
+			// we are in the middle of a column, so skip
+			// to the next character with special meaning
+			i = csv_scan_unquoted(buf, i + 1, end);
 		}
+	}
 
-		if (eof)
-			break;
+	return end;
+}
 
-		if (ready == buflen) {
-			buflen += 1024;
-			buf = realloc(buf, buflen);
-			if (!buf) {
-				fprintf(ctx->err, "realloc: %s\n",
-					strerror(errno));
-				ret = -1;
-				goto end;
+/*
+ * Rows end at the nheaders-th separator, so columns after the last needed
+ * one still have to be counted. When the rest of the row has no quotes this
+ * can be done without stopping at each column. Returns index of the new line
+ * which ends the row, or SIZE_MAX if the caller has to take the slow path
+ * (quotes, wrong number of columns or more data needed).
+ */
+static inline size_t
+skip_row_tail(const char *buf, size_t i, size_t end, size_t commas_left)
+{
+	size_t ncommas;
+	size_t nl = csv_scan_row_tail(buf, i, end, &ncommas);
+
+	if (nl == end || buf[nl] != '\n' || ncommas != commas_left)
+		return SIZE_MAX;
+
+	return nl;
+}
+
+/*
+ * Returns the first column which is not needed by anyone, after which
+ * skip_row_tail can be used, or SIZE_MAX if there's no such column.
+ */
+static size_t
+tail_column(const struct projection *proj)
+{
+	if (!proj || proj->whole_rows)
+		return SIZE_MAX;
+	return proj->last + 1;
+}
+
+struct batch {
+	size_t *row_offs;
+	size_t *row_lens;
+	size_t *col_offs;
+	size_t nrows;
+	/* number of rows row_offs and col_offs have space for */
+	size_t size;
+
+	/* copies of rows, used only when input can't be modified in place */
+	char *copy;
+	size_t copy_size;
+	size_t used;
+};
+
+static int
+batch_init(struct batch *b, size_t nrows, size_t ncols, FILE *err)
+{
+	memset(b, 0, sizeof(*b));
+	b->row_offs = malloc(nrows * sizeof(b->row_offs[0]));
+	b->row_lens = malloc(nrows * sizeof(b->row_lens[0]));
+	b->col_offs = malloc(nrows * ncols * sizeof(b->col_offs[0]));
+	if (!b->row_offs || !b->row_lens || !b->col_offs) {
+		fprintf(err, "malloc: %s\n", strerror(errno));
+		free(b->row_offs);
+		free(b->row_lens);
+		free(b->col_offs);
+		return -1;
+	}
+	b->size = nrows;
+
+	return 0;
+}
+
+static void
+batch_fini(struct batch *b)
+{
+	free(b->row_offs);
+	free(b->row_lens);
+	free(b->col_offs);
+	free(b->copy);
+}
+
+/*
+ * Adds row which starts at buf[start] and ends at buf[end] (at new line
+ * character) to the batch and turns it into a sequence of NUL-terminated
+ * columns. If input can't be modified (copy == true), row is copied into
+ * a side buffer first. If projection is set, only needed columns are
+ * terminated and stored.
+ */
+static int
+add_row(struct batch *b, size_t ncols, const struct projection *proj,
+		bool copy, char *buf, size_t start, size_t end,
+		const size_t *col_offs, FILE *err)
+{
+	size_t len = end - start;
+	char *row;
+
+	/* drop everything after the last needed column */
+	if (proj && !proj->whole_rows && proj->last + 1 < ncols)
+		len = col_offs[proj->last + 1] - 1;
+
+	if (b->nrows == b->size) {
+		size_t size = b->size * 2;
+		size_t *row_offs = realloc(b->row_offs,
+				size * sizeof(b->row_offs[0]));
+		if (!row_offs) {
+			fprintf(err, "realloc: %s\n", strerror(errno));
+			return -1;
+		}
+		b->row_offs = row_offs;
+
+		size_t *row_lens = realloc(b->row_lens,
+				size * sizeof(b->row_lens[0]));
+		if (!row_lens) {
+			fprintf(err, "realloc: %s\n", strerror(errno));
+			return -1;
+		}
+		b->row_lens = row_lens;
+
+		size_t *offs = realloc(b->col_offs,
+				size * ncols * sizeof(b->col_offs[0]));
+		if (!offs) {
+			fprintf(err, "realloc: %s\n", strerror(errno));
+			return -1;
+		}
+		b->col_offs = offs;
+		b->size = size;
+	}
+
+	if (copy) {
+		if (b->used + len + 1 > b->copy_size) {
+			size_t size = b->copy_size ? b->copy_size : 4096;
+			while (size < b->used + len + 1)
+				size *= 2;
+
+			row = realloc(b->copy, size);
+			if (!row) {
+				fprintf(err, "realloc: %s\n", strerror(errno));
+				return -1;
 			}
+			b->copy = row;
+			b->copy_size = size;
 		}
 
-		size_t nmemb = buflen - ready;
-		/*
-		 * Don't ask for too much, otherwise memmove after each row
-		 * becomes a perf problem. TODO: figure out how to fix this
-		 * without impacting code readability.
-		 */
-		if (nmemb > 100)
-			nmemb = 100;
-
-		size_t readin = fread(&buf[ready], 1, nmemb, ctx->in);
-		if (readin < nmemb) {
-			if (!feof(ctx->in)) {
-				fprintf(ctx->err, "fread: %s\n",
-					strerror(errno));
+		row = &b->copy[b->used];
+		memcpy(row, &buf[start], len);
+		b->row_offs[b->nrows] = b->used;
+		b->used += len + 1;
+	} else {
+		row = &buf[start];
+		b->row_offs[b->nrows] = start;
+	}
+
+	size_t *offs = &b->col_offs[b->nrows * ncols];
+
+	if (proj) {
+		for (size_t i = 0; i < proj->ncols; ++i) {
+			size_t col = proj->cols[i];
+			if (col + 1 < ncols)
+				row[col_offs[col + 1] - 1] = 0;
+			offs[col] = col_offs[col];
+		}
+
+		/* csv_writer_raw_row needs all offsets */
+		if (proj->whole_rows)
+			memcpy(offs, col_offs, ncols * sizeof(col_offs[0]));
+	} else {
+		for (size_t i = 1; i < ncols; ++i)
+			row[col_offs[i] - 1] = 0;
+
+		memcpy(offs, col_offs, ncols * sizeof(col_offs[0]));
+	}
+	row[len] = 0;
+
+	b->row_lens[b->nrows] = len;
+	b->nrows++;
+
+	return 0;
+}
+
+/* Passes rows from the batch to the callback, at most BATCH_ROWS at once. */
+static int
+deliver_rows(const char *buf, const struct batch *b, size_t ncols,
+		csv_batch_cb cb, void *arg)
+{
+	for (size_t r = 0; r < b->nrows; r += BATCH_ROWS) {
+		struct csv_batch batch;
+		batch.buf = buf;
+		batch.row_offs = &b->row_offs[r];
+		batch.row_lens = &b->row_lens[r];
+		batch.col_offs = &b->col_offs[r * ncols];
+		batch.nrows = b->nrows - r;
+		if (batch.nrows > BATCH_ROWS)
+			batch.nrows = BATCH_ROWS;
+		batch.ncols = ncols;
+
+		if (cb(&batch, arg))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int
+flush_batch(struct csv_ctx *ctx, struct batch *b, csv_batch_cb cb, void *arg)
+{
+	if (b->nrows == 0)
+		return 0;
+
+	int ret = deliver_rows(ctx->mapped ? b->copy : &ctx->buf[ctx->buf_start],
+			b, ctx->nheaders, cb, arg);
+
+	b->nrows = 0;
+	b->used = 0;
+
+	return ret;
+}
+
+#ifdef C11THREADS_ENABLED
+
+/*
+ * Parallel parsing of mapped input.
+ *
+ * Input is split into chunks of equal size. Every chunk is moved to
+ * the beginning of the first row which starts in it. To find it we need
+ * to know whether the chunk starts inside of a quoted string, which is
+ * decided by parity of the number of quotes before it. Workers count
+ * quotes in their chunks first, so this information is available soon
+ * after the chunk is taken.
+ *
+ * Parsed chunks are stored in a ring of slots and handed to the consumer
+ * by the calling thread in the original order. Workers don't take a chunk
+ * if its slot is still occupied, which limits memory usage.
+ *
+ * Workers are strict - they accept only rows which end with a new line
+ * character and have exactly the expected number of columns. If that's
+ * not the case (stream is corrupted or chunk boundary was misdetected),
+ * the rest of the input is parsed sequentially, so that the behavior
+ * (including error messages) is the same as without threads.
+ */
+
+enum chunk_status {
+	CHUNK_PENDING,
+	CHUNK_PARSED,
+	CHUNK_IRREGULAR,
+	CHUNK_FAILED,
+};
+
+struct chunk {
+	enum chunk_status status;
+	/* beginning of the first row */
+	size_t start;
+	struct batch rows;
+};
+
+#define QUOTES_UNKNOWN 2
+
+struct parallel {
+	struct csv_ctx *ctx;
+	size_t start;
+	size_t end;
+	size_t chunk_size;
+	size_t nchunks;
+
+	/* parity of the number of quotes in chunk i or QUOTES_UNKNOWN */
+	unsigned char *quotes;
+	/* parity of the number of quotes before chunk i, valid up to nknown */
+	unsigned char *parity;
+	size_t nknown;
+
+	struct chunk *slots;
+	size_t nslots;
+
+	/* next chunk to be taken by a worker */
+	size_t next;
+	/* number of chunks handed to the consumer */
+	size_t delivered;
+	bool stop;
+
+	mtx_t mtx;
+	cnd_t cnd;
+};
+
+static size_t
+get_threads(void)
+{
+	const char *env = getenv("CSVNIXTOOLS_THREADS");
+	if (env) {
+		char *end;
+		errno = 0;
+		unsigned long threads = strtoul(env, &end, 10);
+		if (errno == 0 && end != env && *end == 0 && threads > 0)
+			return threads;
+	}
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus <= 0)
+		return 1;
+
+	return (size_t)cpus;
+}
+
+static unsigned char
+quotes_parity(const char *buf, size_t i, size_t end)
+{
+	unsigned char parity = 0;
+
+	while ((i = csv_scan_quoted(buf, i, end)) < end) {
+		parity ^= 1;
+		i++;
+	}
+
+	return parity;
+}
+
+/*
+ * Returns index of the first character after new line which is not
+ * a part of quoted string, starting from buf[i].
+ */
+static size_t
+row_boundary(const char *buf, size_t i, size_t end, bool in_quotes)
+{
+	while (i < end) {
+		if (in_quotes) {
+			i = csv_scan_quoted(buf, i, end);
+			if (i == end)
+				break;
+			in_quotes = false;
+		} else {
+			i = csv_scan_unquoted(buf, i, end);
+			if (i == end)
+				break;
+			if (buf[i] == '\n')
+				return i + 1;
+			if (buf[i] == '"')
+				in_quotes = true;
+		}
+		i++;
+	}
+
+	return end;
+}
+
+static enum chunk_status
+parse_chunk(struct parallel *p, struct chunk *c, size_t start, size_t end,
+		size_t *col_offs)
+{
+	char *buf = p->ctx->buf;
+	size_t ncols = p->ctx->nheaders;
+	struct parse_state st = { false, false };
+	size_t column = 0;
+	size_t row_start = start;
+	size_t i = start;
+	size_t tail_col = tail_column(p->ctx->proj);
+	size_t nl;
+
+	c->start = start;
+	c->rows.nrows = 0;
+	c->rows.used = 0;
+	col_offs[0] = 0;
+
+	while (1) {
+		if (column == tail_col &&
+				(nl = skip_row_tail(buf, i, end,
+					ncols - 1 - column)) != SIZE_MAX) {
+			i = nl;
+			column = ncols - 1;
+		} else {
+			i = skip_column(buf, i, end, &st,
+					row_start + col_offs[column]);
+		}
+		if (i == end || i == PARSE_ERROR)
+			break;
+
+		column++;
+		if (column == ncols) {
+			if (buf[i] != '\n')
+				return CHUNK_IRREGULAR;
+
+			if (add_row(&c->rows, ncols, p->ctx->proj, true, buf,
+					row_start, i, col_offs, p->ctx->err))
+				return CHUNK_FAILED;
+
+			i++;
+			row_start = i;
+			column = 0;
+		} else {
+			if (buf[i] != ',')
+				return CHUNK_IRREGULAR;
+
+			i++;
+			col_offs[column] = i - row_start;
+		}
+	}
+
+	if (i != end || row_start != end)
+		return CHUNK_IRREGULAR;
+
+	return CHUNK_PARSED;
+}
+
+static int
+parse_worker(void *arg)
+{
+	struct parallel *p = arg;
+	const char *buf = p->ctx->buf;
+	size_t *col_offs = malloc(p->ctx->nheaders * sizeof(col_offs[0]));
+
+	mtx_lock_nofail(&p->mtx);
+	while (1) {
+		while (!p->stop && p->next < p->nchunks &&
+				p->next >= p->delivered + p->nslots)
+			cnd_wait_nofail(&p->cnd, &p->mtx);
+
+		if (p->stop || p->next == p->nchunks)
+			break;
+
+		size_t k = p->next++;
+		struct chunk *c = &p->slots[k % p->nslots];
+		size_t raw_start = p->start + k * p->chunk_size;
+		size_t raw_end = raw_start + p->chunk_size;
+		if (k == p->nchunks - 1)
+			raw_end = p->end;
+
+		mtx_unlock_nofail(&p->mtx);
+
+		unsigned char quotes = quotes_parity(buf, raw_start, raw_end);
+
+		mtx_lock_nofail(&p->mtx);
+		p->quotes[k] = quotes;
+		while (p->nknown < p->nchunks &&
+				p->quotes[p->nknown] != QUOTES_UNKNOWN) {
+			p->parity[p->nknown + 1] =
+				p->parity[p->nknown] ^ p->quotes[p->nknown];
+			p->nknown++;
+		}
+		cnd_broadcast_nofail(&p->cnd);
+
+		while (!p->stop && p->nknown < k + 1)
+			cnd_wait_nofail(&p->cnd, &p->mtx);
+
+		if (p->stop)
+			break;
+
+		bool in_quotes = p->parity[k];
+		bool next_in_quotes = p->parity[k + 1];
+		mtx_unlock_nofail(&p->mtx);
+
+		size_t start = p->start;
+		if (k > 0)
+			start = row_boundary(buf, raw_start, p->end, in_quotes);
+
+		size_t end = p->end;
+		if (k < p->nchunks - 1)
+			end = row_boundary(buf, raw_end, p->end,
+					next_in_quotes);
+
+		enum chunk_status status;
+		if (!col_offs) {
+			fprintf(p->ctx->err, "malloc: %s\n", strerror(errno));
+			status = CHUNK_FAILED;
+		} else if (start > end) {
+			/* boundaries are inconsistent, input must be corrupted */
+			c->start = start;
+			status = CHUNK_IRREGULAR;
+		} else {
+			status = parse_chunk(p, c, start, end, col_offs);
+		}
+
+		mtx_lock_nofail(&p->mtx);
+		c->status = status;
+		cnd_broadcast_nofail(&p->cnd);
+	}
+	mtx_unlock_nofail(&p->mtx);
+
+	free(col_offs);
+
+	return 0;
+}
+
+/*
+ * Parses input from ctx->buf_start using many threads.
+ *
+ * Returns 0 when whole input was consumed, 1 when callback asked to stop,
+ * -1 on error or 2 when the rest of the input, from ctx->buf_start, has
+ * to be parsed sequentially.
+ */
+static int
+read_parallel(struct csv_ctx *ctx, size_t nthreads, csv_batch_cb cb,
+		void *arg)
+{
+	struct parallel p;
+	int ret = 0;
+
+	memset(&p, 0, sizeof(p));
+	p.ctx = ctx;
+	p.start = ctx->buf_start;
+	p.end = ctx->buf_ready;
+	p.chunk_size = ctx->chunk_size;
+	p.nchunks = (p.end - p.start + p.chunk_size - 1) / p.chunk_size;
+	p.nslots = 2 * nthreads;
+
+	p.quotes = malloc(p.nchunks);
+	p.parity = malloc(p.nchunks + 1);
+	p.slots = calloc(p.nslots, sizeof(p.slots[0]));
+	thrd_t *threads = malloc(nthreads * sizeof(threads[0]));
+	if (!p.quotes || !p.parity || !p.slots || !threads) {
+		fprintf(ctx->err, "malloc: %s\n", strerror(errno));
+		ret = -1;
+		goto end;
+	}
+
+	memset(p.quotes, QUOTES_UNKNOWN, p.nchunks);
+	p.parity[0] = 0;
+
+	for (size_t i = 0; i < p.nslots; ++i) {
+		if (batch_init(&p.slots[i].rows, BATCH_ROWS, ctx->nheaders,
+				ctx->err)) {
+			for (size_t j = 0; j < i; ++j)
+				batch_fini(&p.slots[j].rows);
+			ret = -1;
+			goto end;
+		}
+	}
+
+	mtx_init_nofail(&p.mtx, mtx_plain);
+	cnd_init_nofail(&p.cnd);
+
+	for (size_t i = 0; i < nthreads; ++i)
+		thrd_create_nofail(&threads[i], parse_worker, &p);
+
+	for (size_t k = 0; k < p.nchunks; ++k) {
+		struct chunk *c = &p.slots[k % p.nslots];
+
+		mtx_lock_nofail(&p.mtx);
+		while (c->status == CHUNK_PENDING)
+			cnd_wait_nofail(&p.cnd, &p.mtx);
+		mtx_unlock_nofail(&p.mtx);
+
+		if (c->status == CHUNK_IRREGULAR) {
+			ctx->buf_start = c->start;
+			ret = 2;
+			break;
+		}
+
+		if (c->status == CHUNK_FAILED) {
+			ret = -1;
+			break;
+		}
+
+		if (deliver_rows(c->rows.copy, &c->rows, ctx->nheaders, cb,
+				arg)) {
+			ret = 1;
+			break;
+		}
+
+		mtx_lock_nofail(&p.mtx);
+		c->status = CHUNK_PENDING;
+		p.delivered++;
+		cnd_broadcast_nofail(&p.cnd);
+		mtx_unlock_nofail(&p.mtx);
+	}
+
+	if (ret == 0)
+		ctx->buf_start = p.end;
+
+	mtx_lock_nofail(&p.mtx);
+	p.stop = true;
+	cnd_broadcast_nofail(&p.cnd);
+	mtx_unlock_nofail(&p.mtx);
+
+	for (size_t i = 0; i < nthreads; ++i)
+		thrd_join_nofail(threads[i], NULL);
+
+	cnd_destroy(&p.cnd);
+	mtx_destroy(&p.mtx);
+
+	for (size_t i = 0; i < p.nslots; ++i)
+		batch_fini(&p.slots[i].rows);
+
+end:
+	free(threads);
+	free(p.slots);
+	free(p.parity);
+	free(p.quotes);
+
+	return ret;
+}
+
+#endif
+
+int
+csv_read_batches(struct csv_ctx *ctx, csv_batch_cb cb, void *arg)
+{
+	int ret = 0;
+	struct batch b;
+	size_t *col_offs = NULL;
+
+#ifdef C11THREADS_ENABLED
+	if (ctx->mapped &&
+			ctx->buf_ready - ctx->buf_start > ctx->chunk_size) {
+		size_t nthreads = get_threads();
+		if (nthreads > 1) {
+			ret = read_parallel(ctx, nthreads, cb, arg);
+			if (ret != 2)
+				return ret;
+			ret = 0;
+		}
+	}
+#endif
+
+	if (batch_init(&b, BATCH_ROWS, ctx->nheaders, ctx->err))
+		return -1;
+
+	ctx->reading_rows = true;
+
+	col_offs = malloc(ctx->nheaders * sizeof(col_offs[0]));
+	if (!col_offs) {
+		fprintf(ctx->err, "malloc: %s\n", strerror(errno));
+		ret = -1;
+		goto end;
+	}
+
+	struct parse_state st = { false, false };
+	size_t column = 0;
+	size_t tail_col = tail_column(ctx->proj);
+	size_t nl;
+	col_offs[0] = 0;
+
+	/*
+	 * i and row_start are relative to the beginning of the current batch
+	 * (ctx->buf_start), col_offs are relative to the beginning of
+	 * the current row, so they stay valid when refill moves data.
+	 */
+	size_t i = 0;
+	size_t row_start = 0;
+
+	while (1) {
+		char *buf = &ctx->buf[ctx->buf_start];
+		size_t ready = ctx->buf_ready - ctx->buf_start;
+
+		while (1) {
+			if (column == tail_col && !st.in_quoted_string &&
+					!st.last_char_was_quot &&
+					(nl = skip_row_tail(buf, i, ready,
+						ctx->nheaders - 1 - column)) !=
+						SIZE_MAX) {
+				i = nl;
+				column = ctx->nheaders - 1;
+			} else {
+				i = skip_column(buf, i, ready, &st,
+						row_start + col_offs[column]);
+			}
+			if (i == ready)
+				break;
+
+			if (i == PARSE_ERROR) {
+				// rows before the corrupted one are fine
+				if (flush_batch(ctx, &b, cb, arg)) {
+					ret = 1;
+					goto end;
+				}
+
+				fprintf(ctx->err,
+					"corrupted stream - \" in the middle of unquoted string\n");
 				ret = -1;
 				goto end;
 			}
 
-			eof = 1;
+			column++;
+			if (column == ctx->nheaders) {
+				if (add_row(&b, ctx->nheaders, ctx->proj,
+						ctx->mapped, buf, row_start, i,
+						col_offs, ctx->err)) {
+					ret = -1;
+					goto end;
+				}
+
+				// move on to the next row
+				i++;
+				row_start = i;
+				column = 0;
+
+				if (b.nrows < BATCH_ROWS)
+					continue;
+
+				if (flush_batch(ctx, &b, cb, arg)) {
+					ret = 1;
+					goto end;
+				}
+
+				ctx->buf_start += row_start;
+				buf += row_start;
+				ready -= row_start;
+				i = 0;
+				row_start = 0;
+			} else {
+				// move on to the next column
+				i++;
+				col_offs[column] = i - row_start;
+			}
+		}
+
+		// deliver what we have before (potentially) waiting for data
+		if (flush_batch(ctx, &b, cb, arg)) {
+			ret = 1;
+			goto end;
+		}
+
+		ctx->buf_start += row_start;
+		i -= row_start;
+		row_start = 0;
+
+		ssize_t readin = refill(ctx);
+		if (readin < 0) {
+			ret = -1;
+			goto end;
 		}
 
-		start_off = ready;
-		ready += readin;
+		if (readin == 0)
+			break;
 	}
 
 end:
+	ctx->reading_rows = false;
 	free(col_offs);
-	free(buf);
+	batch_fini(&b);
 
 	return ret;
 }
 
+void
+csv_read_batches_nofail(struct csv_ctx *ctx, csv_batch_cb cb, void *arg)
+{
+	if (csv_read_batches(ctx, cb, arg))
+		exit(2);
+}
+
+struct row_cb_params {
+	csv_row_cb cb;
+	void *arg;
+};
+
+static int
+next_batch(const struct csv_batch *batch, void *arg)
+{
+	struct row_cb_params *params = arg;
+
+	for (size_t i = 0; i < batch->nrows; ++i) {
+		if (params->cb(&batch->buf[batch->row_offs[i]],
+				&batch->col_offs[i * batch->ncols],
+				batch->ncols, params->arg))
+			return 1;
+	}
+
+	return 0;
+}
+
+int
+csv_read_all(struct csv_ctx *ctx, csv_row_cb cb, void *arg)
+{
+	struct row_cb_params params;
+	params.cb = cb;
+	params.arg = arg;
+
+	return csv_read_batches(ctx, next_batch, &params);
+}
+
 void
 csv_read_all_nofail(struct csv_ctx *ctx, csv_row_cb cb, void *arg)
 {
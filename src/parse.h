@@ -30,12 +30,51 @@ int csv_parse_header(struct csv_ctx *ctx);
 
 size_t csv_get_headers(struct csv_ctx *ctx, const struct col_header **headers);
 
+/*
+ * Declares that callbacks will look only at columns cols[0..ncols-1] (must
+ * be called after csv_read_header). Other columns won't be NUL-terminated
+ * and their offsets won't be set. If rows have to be printed with
+ * csv_writer_raw_row, whole_rows must be true - otherwise rows are cut
+ * after the last needed column and row_lens cover only that part.
+ */
+int csv_set_needed_columns(struct csv_ctx *ctx, const size_t *cols,
+		size_t ncols, bool whole_rows);
+void csv_set_needed_columns_nofail(struct csv_ctx *ctx, const size_t *cols,
+		size_t ncols, bool whole_rows);
+
 typedef int (*csv_row_cb)(const char *buf, const size_t *col_offs,
 		size_t ncols, void *arg);
 
 int csv_read_all(struct csv_ctx *ctx, csv_row_cb cb, void *arg);
 void csv_read_all_nofail(struct csv_ctx *ctx, csv_row_cb cb, void *arg);
 
+/*
+ * Block of consecutive rows. Row i starts at &buf[row_offs[i]] and
+ * its columns start at offsets col_offs[i * ncols + 0 .. ncols - 1],
+ * relative to the beginning of the row (so each row can be passed to code
+ * expecting csv_row_cb arguments). All columns are NUL-terminated, unless
+ * csv_set_needed_columns was used - then only the needed columns are,
+ * and offsets of other columns are either not set or (with whole_rows)
+ * point into text which isn't terminated.
+ *
+ * Row i occupies row_lens[i] bytes (without new line character), which
+ * are the original bytes of the row, except for commas after terminated
+ * columns, which are replaced by NULs. See csv_writer_raw_row.
+ */
+struct csv_batch {
+	const char *buf;
+	const size_t *row_offs;
+	const size_t *row_lens;
+	const size_t *col_offs;
+	size_t nrows;
+	size_t ncols;
+};
+
+typedef int (*csv_batch_cb)(const struct csv_batch *batch, void *arg);
+
+int csv_read_batches(struct csv_ctx *ctx, csv_batch_cb cb, void *arg);
+void csv_read_batches_nofail(struct csv_ctx *ctx, csv_batch_cb cb, void *arg);
+
 void csv_destroy_ctx(struct csv_ctx *ctx);
 
 #endif
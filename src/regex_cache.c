@@ -1,9 +1,13 @@
 /*
  * SPDX-License-Identifier: BSD-3-Clause
  *
- * Copyright 2020, Marcin Ślusarz <marcin.slusarz@gmail.com>
+ * Copyright 2020-2021, Marcin Ślusarz <marcin.slusarz@gmail.com>
  */
 
+#include <errno.h>
+#include <langinfo.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,83 +15,535 @@
 #include "regex_cache.h"
 #include "utils.h"
 
-#define CACHE_SIZE 10
+#define DEFAULT_CACHE_SIZE 64
 
-static struct reg {
+/*
+ * Compiled expressions are looked up by a hash of the pattern and flags.
+ * All entries are also linked into a list ordered by the time of last use,
+ * so when the cache is full the least recently used one can be replaced.
+ */
+struct reg {
 	char *regex;
 	int cflags;
-	regex_t comp;
-} Cache[CACHE_SIZE];
+	uint64_t hash;
+	struct csv_regex comp;
 
-static unsigned Used;
-static unsigned Next_to_use;
+	struct reg *hnext;
+	struct reg *prev;
+	struct reg *next;
+};
 
-int
-csv_regex_get(regex_t **preg, const char *regex, int cflags)
+static struct reg **Buckets;
+static size_t Nbuckets;
+static size_t Size;
+static size_t Used;
+
+/* most and least recently used entries */
+static struct reg *Head;
+static struct reg *Tail;
+
+static struct {
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	/* constant expressions compiled once, bypassing the cache */
+	size_t bound;
+} Stats;
+
+static size_t
+get_cache_size(void)
 {
-	struct reg *r;
-	for (unsigned i = 0; i < Used; ++i) {
-		r = &Cache[i];
+	const char *env = getenv("CSVNIXTOOLS_REGEX_CACHE_SIZE");
+	if (!env)
+		return DEFAULT_CACHE_SIZE;
 
-		if (r->cflags != cflags)
-			continue;
-		if (r->regex == NULL)
+	char *end;
+	errno = 0;
+	unsigned long long size = strtoull(env, &end, 0);
+	if (errno || end == env || *end || size == 0 || size > SIZE_MAX / 4)
+		return DEFAULT_CACHE_SIZE;
+
+	return (size_t)size;
+}
+
+static uint64_t
+hash_regex(const char *regex, int cflags)
+{
+	/* FNV-1a */
+	uint64_t h = 0xcbf29ce484222325ULL ^ (unsigned)cflags;
+
+	for (const unsigned char *c = (const unsigned char *)regex; *c; ++c) {
+		h ^= *c;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+static void
+lru_unlink(struct reg *r)
+{
+	if (r->prev)
+		r->prev->next = r->next;
+	else
+		Head = r->next;
+
+	if (r->next)
+		r->next->prev = r->prev;
+	else
+		Tail = r->prev;
+}
+
+static void
+lru_push_front(struct reg *r)
+{
+	r->prev = NULL;
+	r->next = Head;
+	if (Head)
+		Head->prev = r;
+	else
+		Tail = r;
+	Head = r;
+}
+
+static void
+bucket_remove(struct reg *r)
+{
+	struct reg **p = &Buckets[r->hash & (Nbuckets - 1)];
+
+	while (*p != r)
+		p = &(*p)->hnext;
+	*p = r->hnext;
+}
+
+/*
+ * Helpers of required_literal. Runs of literal characters are collected
+ * in run, the longest one is remembered in best.
+ */
+struct literal_state {
+	char *run;
+	size_t run_len;
+	/* start of the last character in run, for quantifiers */
+	size_t last_start;
+	bool last_literal;
+
+	char *best;
+	size_t best_len;
+};
+
+static void
+end_run(struct literal_state *st)
+{
+	if (st->run_len > st->best_len) {
+		memcpy(st->best, st->run, st->run_len);
+		st->best_len = st->run_len;
+	}
+
+	st->run_len = 0;
+	st->last_literal = false;
+}
+
+static void
+add_literal(struct literal_state *st, unsigned char c, bool icase, bool utf8)
+{
+	/*
+	 * Case insensitive matching folds some non-ASCII characters to
+	 * i, k and s (e.g. Kelvin sign), which ASCII comparison wouldn't.
+	 */
+	if (icase && (c >= 0x80 || strchr("iIkKsS", c))) {
+		end_run(st);
+		return;
+	}
+
+	/* continuation bytes of UTF-8 sequences belong to previous character */
+	if (!utf8 || (c & 0xC0) != 0x80)
+		st->last_start = st->run_len;
+	st->run[st->run_len++] = (char)c;
+	st->last_literal = true;
+}
+
+/* quantifier applies to the last atom, so it's not required anymore */
+static void
+quantifier(struct literal_state *st)
+{
+	if (st->last_literal)
+		st->run_len = st->last_start;
+	end_run(st);
+}
+
+/* returns index of the character after bracket expression, 0 on error */
+static size_t
+skip_bracket(const char *p, size_t i)
+{
+	i++;
+	if (p[i] == '^')
+		i++;
+	if (p[i] == ']')
+		i++;
+
+	while (p[i] && p[i] != ']') {
+		if (p[i] == '[' && (p[i + 1] == ':' || p[i + 1] == '.' ||
+				p[i + 1] == '=')) {
+			char end[3] = { p[i + 1], ']', 0 };
+			const char *e = strstr(p + i + 2, end);
+			if (!e)
+				return 0;
+			i = (size_t)(e - p) + 2;
+		} else {
+			i++;
+		}
+	}
+
+	if (!p[i])
+		return 0;
+
+	return i + 1;
+}
+
+/* returns index of the character after group, 0 on error */
+static size_t
+skip_group(const char *p, size_t i, bool ere)
+{
+	unsigned depth = 0;
+
+	while (p[i]) {
+		if (p[i] == '[') {
+			i = skip_bracket(p, i);
+			if (!i)
+				return 0;
 			continue;
-		if (strcmp(r->regex, regex) != 0)
+		}
+
+		if (ere) {
+			if (p[i] == '\\') {
+				if (!p[i + 1])
+					return 0;
+				i += 2;
+				continue;
+			}
+			if (p[i] == '(')
+				depth++;
+			else if (p[i] == ')' && --depth == 0)
+				return i + 1;
+			i++;
+		} else {
+			if (p[i] != '\\') {
+				i++;
+				continue;
+			}
+			if (p[i + 1] == '(')
+				depth++;
+			else if (p[i + 1] == ')' && --depth == 0)
+				return i + 2;
+			else if (!p[i + 1])
+				return 0;
+			i += 2;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Finds the longest string of literal characters which every match of
+ * the pattern must contain. Groups, bracket expressions, anchors and
+ * escapes with special meaning end the current string, quantifiers remove
+ * the last character from it. Alternation at the top level means there's
+ * no such string. Returns NULL if nothing was found.
+ */
+static char *
+required_literal(const char *p, int cflags)
+{
+	bool ere = cflags & REG_EXTENDED;
+	bool icase = cflags & REG_ICASE;
+	bool utf8 = false;
+
+	if (MB_CUR_MAX > 1) {
+		/* other multibyte encodings may reuse ASCII bytes */
+		if (strcmp(nl_langinfo(CODESET), "UTF-8") != 0)
+			return NULL;
+		utf8 = true;
+	}
+
+	size_t len = strlen(p);
+	struct literal_state st;
+	st.run = xmalloc_nofail(len + 1, 1);
+	st.best = xmalloc_nofail(len + 1, 1);
+	st.run_len = 0;
+	st.best_len = 0;
+	st.last_start = 0;
+	st.last_literal = false;
+
+	size_t i = 0;
+	while (p[i]) {
+		char c = p[i];
+
+		if (c == '[') {
+			end_run(&st);
+			i = skip_bracket(p, i);
+			if (!i)
+				goto none;
+		} else if (c == '.' || c == '^' || c == '$') {
+			end_run(&st);
+			i++;
+		} else if (c == '*') {
+			quantifier(&st);
+			i++;
+		} else if (ere && (c == '+' || c == '?')) {
+			quantifier(&st);
+			i++;
+		} else if (ere && c == '{') {
+			quantifier(&st);
+			const char *e = strchr(p + i, '}');
+			if (!e)
+				goto none;
+			i = (size_t)(e - p) + 1;
+		} else if (ere && c == '|') {
+			goto none;
+		} else if (ere && c == '(') {
+			end_run(&st);
+			i = skip_group(p, i, true);
+			if (!i)
+				goto none;
+		} else if (ere && c == ')') {
+			end_run(&st);
+			i++;
+		} else if (c == '\\') {
+			char n = p[i + 1];
+
+			if (!n)
+				goto none;
+
+			if (!ere && (n == '+' || n == '?')) {
+				quantifier(&st);
+				i += 2;
+			} else if (!ere && n == '{') {
+				quantifier(&st);
+				const char *e = strstr(p + i, "\\}");
+				if (!e)
+					goto none;
+				i = (size_t)(e - p) + 2;
+			} else if (!ere && n == '|') {
+				goto none;
+			} else if (!ere && n == '(') {
+				end_run(&st);
+				i = skip_group(p, i, false);
+				if (!i)
+					goto none;
+			} else if (strchr(".[]*^$\\/", n) ||
+					(ere && strchr("(){}|+?", n))) {
+				add_literal(&st, (unsigned char)n, icase, utf8);
+				i += 2;
+			} else {
+				/* back references and GNU extensions */
+				end_run(&st);
+				i += 2;
+			}
+		} else {
+			add_literal(&st, (unsigned char)c, icase, utf8);
+			i++;
+		}
+	}
+
+	end_run(&st);
+	free(st.run);
+
+	if (st.best_len == 0) {
+		free(st.best);
+		return NULL;
+	}
+
+	st.best[st.best_len] = 0;
+	return st.best;
+
+none:
+	free(st.run);
+	free(st.best);
+	return NULL;
+}
+
+int
+csv_regex_compile(struct csv_regex *re, const char *regex, int cflags)
+{
+	int ret = regcomp(&re->comp, regex, cflags);
+	if (ret)
+		return ret;
+
+	re->literal = required_literal(regex, cflags);
+	re->icase = cflags & REG_ICASE;
+
+	return 0;
+}
+
+void
+csv_regex_print_error(int err, const struct csv_regex *re, const char *regex)
+{
+	size_t len = regerror(err, &re->comp, NULL, 0);
+	char *errbuf = xmalloc_nofail(len, 1);
+	regerror(err, &re->comp, errbuf, len);
+	fprintf(stderr, "compilation of expression '%s' failed: %s\n",
+			regex, errbuf);
+	free(errbuf);
+}
+
+static inline unsigned char
+ascii_tolower(unsigned char c)
+{
+	return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+
+/*
+ * ASCII-only version of strcasestr, independent of locale (literals of
+ * case-insensitive expressions contain only ASCII characters).
+ */
+static bool
+contains_icase(const char *str, const char *literal)
+{
+	unsigned char first = ascii_tolower((unsigned char)literal[0]);
+
+	for (; *str; ++str) {
+		if (ascii_tolower((unsigned char)*str) != first)
 			continue;
 
+		size_t j = 1;
+		while (literal[j] && str[j] &&
+				ascii_tolower((unsigned char)str[j]) ==
+				ascii_tolower((unsigned char)literal[j]))
+			j++;
+		if (!literal[j])
+			return true;
+	}
+
+	return false;
+}
+
+int
+csv_regex_exec(const struct csv_regex *re, const char *str, size_t nmatch,
+		regmatch_t pmatch[])
+{
+	if (re->literal) {
+		bool found = re->icase ? contains_icase(str, re->literal) :
+				strstr(str, re->literal) != NULL;
+		if (!found)
+			return REG_NOMATCH;
+	}
+
+	return regexec(&re->comp, str, nmatch, pmatch, 0);
+}
+
+void
+csv_regex_free(struct csv_regex *re)
+{
+	regfree(&re->comp);
+	free(re->literal);
+	re->literal = NULL;
+}
+
+int
+csv_regex_get(struct csv_regex **preg, const char *regex, int cflags)
+{
+	if (!Buckets) {
+		if (Size == 0)
+			Size = get_cache_size();
+
+		Nbuckets = 1;
+		while (Nbuckets < Size * 2)
+			Nbuckets *= 2;
+		Buckets = xcalloc_nofail(Nbuckets, sizeof(Buckets[0]));
+	}
+
+	uint64_t hash = hash_regex(regex, cflags);
+	struct reg *r = Buckets[hash & (Nbuckets - 1)];
+
+	while (r) {
+		if (r->hash == hash && r->cflags == cflags &&
+				strcmp(r->regex, regex) == 0)
+			break;
+		r = r->hnext;
+	}
+
+	if (r) {
+		Stats.hits++;
+		if (r != Head) {
+			lru_unlink(r);
+			lru_push_front(r);
+		}
+
 		*preg = &r->comp;
 		return 0;
 	}
 
-	r = &Cache[Next_to_use];
-	if (r->regex) {
-		regfree(&r->comp);
-		free(r->regex);
-		memset(r, 0, sizeof(*r));
-	}
+	Stats.misses++;
 
-	int ret = regcomp(&r->comp, regex, cflags);
+	struct csv_regex comp;
+	int ret = csv_regex_compile(&comp, regex, cflags);
 	if (ret) {
-		size_t len = regerror(ret, &r->comp, NULL, 0);
-		char *errbuf = xmalloc_nofail(len, 1);
-		regerror(ret, &r->comp, errbuf, len);
-		fprintf(stderr,
-			"compilation of expression '%s' failed: %s\n",
-			regex, errbuf);
-		free(errbuf);
-		memset(&r->comp, 0, sizeof(r->comp));
+		csv_regex_print_error(ret, &comp, regex);
 		*preg = NULL;
 		return -1;
 	}
 
-	r->cflags = cflags;
-	r->regex = xstrdup_nofail(regex);
-	if (Used != CACHE_SIZE)
+	if (Used == Size) {
+		r = Tail;
+		lru_unlink(r);
+		bucket_remove(r);
+		csv_regex_free(&r->comp);
+		free(r->regex);
+		Stats.evictions++;
+	} else {
+		r = xmalloc_nofail(1, sizeof(*r));
 		Used++;
-	Next_to_use++;
-	if (Next_to_use == CACHE_SIZE)
-		Next_to_use = 0;
+	}
+
+	r->regex = xstrdup_nofail(regex);
+	r->cflags = cflags;
+	r->hash = hash;
+	r->comp = comp;
+
+	struct reg **bucket = &Buckets[hash & (Nbuckets - 1)];
+	r->hnext = *bucket;
+	*bucket = r;
+	lru_push_front(r);
 
 	*preg = &r->comp;
 
 	return 0;
 }
 
+void
+csv_regex_bound(void)
+{
+	Stats.bound++;
+}
+
 void
 csv_regex_clear_cache(void)
 {
-	for (unsigned i = 0; i < Used; ++i) {
-		struct reg *r = &Cache[i];
+	const char *env = getenv("CSVNIXTOOLS_REGEX_STATS");
+	if (env && strcmp(env, "1") == 0 &&
+			(Stats.hits || Stats.misses || Stats.bound)) {
+		fprintf(stderr,
+			"regex cache: %zu hits, %zu misses, %zu evictions, %zu bound\n",
+			Stats.hits, Stats.misses, Stats.evictions,
+			Stats.bound);
+	}
 
-		if (r->regex == NULL)
-			continue;
+	struct reg *r = Head;
+	while (r) {
+		struct reg *next = r->next;
 
+		csv_regex_free(&r->comp);
 		free(r->regex);
-		regfree(&r->comp);
-		memset(r, 0, sizeof(*r));
+		free(r);
+
+		r = next;
 	}
 
+	free(Buckets);
+	Buckets = NULL;
+	Nbuckets = 0;
 	Used = 0;
-	Next_to_use = 0;
+	Head = NULL;
+	Tail = NULL;
+	memset(&Stats, 0, sizeof(Stats));
 }
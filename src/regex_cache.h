@@ -1,15 +1,51 @@
 /*
  * SPDX-License-Identifier: BSD-3-Clause
  *
- * Copyright 2020, Marcin Ślusarz <marcin.slusarz@gmail.com>
+ * Copyright 2020-2021, Marcin Ślusarz <marcin.slusarz@gmail.com>
  */
 
 #ifndef CSV_REGEX_CACHE_H
 #define CSV_REGEX_CACHE_H
 
 #include <regex.h>
+#include <stdbool.h>
+#include <stddef.h>
 
-int csv_regex_get(regex_t **preg, const char *regex, int cflags);
+/*
+ * Compiled regular expression with the longest string every match must
+ * contain. Values which don't contain it are rejected without running
+ * the regex engine.
+ */
+struct csv_regex {
+	regex_t comp;
+	char *literal;
+	bool icase;
+};
+
+/* returns 0 or error code of regcomp */
+int csv_regex_compile(struct csv_regex *re, const char *regex, int cflags);
+void csv_regex_print_error(int err, const struct csv_regex *re,
+		const char *regex);
+/* works like regexec */
+int csv_regex_exec(const struct csv_regex *re, const char *str, size_t nmatch,
+		regmatch_t pmatch[]);
+void csv_regex_free(struct csv_regex *re);
+
+/*
+ * Returns compiled expression from the cache. It stays valid until the next
+ * call to csv_regex_get or csv_regex_clear_cache. The cache keeps up to 64
+ * expressions, CSVNIXTOOLS_REGEX_CACHE_SIZE environment variable overrides
+ * that.
+ */
+int csv_regex_get(struct csv_regex **preg, const char *regex, int cflags);
+
+/* counts expression compiled once by the caller, bypassing the cache */
+void csv_regex_bound(void);
+
+/*
+ * Frees all cached expressions. If CSVNIXTOOLS_REGEX_STATS is set to 1,
+ * prints statistics to stderr first.
+ */
 void csv_regex_clear_cache(void);
 
 #endif
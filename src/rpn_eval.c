@@ -17,15 +17,17 @@
 #include "utils.h"
 
 static char *
-tostring(long long val, long long base)
+tostring(struct csv_arena *scratch, long long val, long long base)
 {
-	char *str;
+	char buf[CSV_NUMBER_BUF_SIZE];
 
 	if (base == 2) {
 		if (val == 0)
-			return xstrdup_nofail("0b0");
+			return csv_arena_strndup(scratch, "0b0", 3);
 
-		str = xmalloc_nofail(68, 1);
+		char *str = csv_arena_alloc(scratch, 68);
+		if (!str)
+			return NULL;
 		int idx = 0;
 		if (val < 0) {
 			str[idx++] = '-';
@@ -40,36 +42,34 @@ tostring(long long val, long long base)
 			msb >>= 1;
 		}
 		str[idx] = 0;
+
+		return str;
 	} else if (base == 8) {
-		if (csv_asprintf(&str, "0%llo", val) < 0) {
-			perror("asprintf");
-			str = NULL;
-		}
+		snprintf(buf, sizeof(buf), "0%llo", val);
 	} else if (base == 10) {
-		if (csv_asprintf(&str, "%lld", val) < 0) {
-			perror("asprintf");
-			str = NULL;
-		}
+		csv_format_int(buf, val);
 	} else if (base == 16) {
-		if (csv_asprintf(&str, "0x%llx", val) < 0) {
-			perror("asprintf");
-			str = NULL;
-		}
+		snprintf(buf, sizeof(buf), "0x%llx", val);
 	} else {
 		/* not possible, checked earlier */
 		abort();
 	}
 
-	return str;
+	return csv_arena_strndup(scratch, buf, strlen(buf));
 }
 
-static char *
-replace_re(const char *str, const char *replacement, const regmatch_t *matches)
+/*
+ * Builds replacement string in *pbuf (reused between calls). Returns its
+ * length.
+ */
+static size_t
+replace_re(const char *str, const char *replacement, const regmatch_t *matches,
+		char **pbuf, size_t *pbuflen)
 {
 	size_t len = strlen(replacement);
 
-	size_t buflen = len + 1;
-	char *buf = xmalloc_nofail(buflen, 1);
+	char *buf = *pbuf;
+	size_t buflen = *pbuflen;
 	size_t buf_used = 0;
 
 	for (size_t i = 0; i < len; ++i) {
@@ -124,7 +124,91 @@ replace_re(const char *str, const char *replacement, const regmatch_t *matches)
 	csv_check_space(&buf, &buflen, buf_used, 1);
 	buf[buf_used] = 0;
 
-	return buf;
+	*pbuf = buf;
+	*pbuflen = buflen;
+
+	return buf_used;
+}
+
+/*
+ * SQL LIKE pattern split on '%'. The first segment must match at the
+ * beginning of the string, the last one at the end and the ones between
+ * them anywhere in between, in order. Pattern without '%' has only one
+ * segment, which must match the whole string.
+ */
+struct like_pattern {
+	size_t nsegs;
+	struct like_seg {
+		const char *str;
+		size_t len;
+	} segs[];
+};
+
+static struct like_pattern *
+like_compile(struct csv_arena *arena, const char *pattern)
+{
+	size_t nsegs = 1;
+	for (const char *c = pattern; *c; ++c)
+		if (*c == '%')
+			nsegs++;
+
+	struct like_pattern *p = csv_arena_alloc(arena,
+			sizeof(*p) + nsegs * sizeof(p->segs[0]));
+	if (!p)
+		return NULL;
+
+	p->nsegs = 0;
+	const char *start = pattern;
+	const char *c = pattern;
+	while (1) {
+		if (*c == '%' || *c == 0) {
+			struct like_seg *seg = &p->segs[p->nsegs++];
+			seg->str = start;
+			seg->len = (size_t)(c - start);
+			if (*c == 0)
+				break;
+			start = c + 1;
+		}
+		c++;
+	}
+
+	return p;
+}
+
+static bool
+like_match(const struct like_pattern *p, const char *str)
+{
+	size_t len = strlen(str);
+	const struct like_seg *first = &p->segs[0];
+
+	if (p->nsegs == 1)
+		return len == first->len && memcmp(str, first->str, len) == 0;
+
+	const struct like_seg *last = &p->segs[p->nsegs - 1];
+
+	if (len < first->len + last->len)
+		return false;
+	if (memcmp(str, first->str, first->len) != 0)
+		return false;
+	if (memcmp(str + len - last->len, last->str, last->len) != 0)
+		return false;
+
+	/* leftmost match of each middle segment is always the best one */
+	const char *cur = str + first->len;
+	const char *end = str + len - last->len;
+	for (size_t i = 1; i < p->nsegs - 1; ++i) {
+		const struct like_seg *seg = &p->segs[i];
+		if (seg->len == 0)
+			continue;
+
+		const char *found = csv_memmem(cur, (size_t)(end - cur),
+				seg->str, seg->len);
+		if (!found)
+			return false;
+		cur = found + seg->len;
+	}
+
+	return true;
 }
 
 static struct csv_ht *Seq;
@@ -205,10 +289,56 @@ is_numeric(enum rpn_variant_type t)
 }
 
 static int
-eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
+regex_flags(enum rpn_operator oper, long long case_sensitive)
+{
+	int flags = case_sensitive ? 0 : REG_ICASE;
+
+	if (oper == RPN_MATCHES_BRE || oper == RPN_MATCHES_ERE)
+		flags |= REG_NOSUB;
+	if (oper == RPN_REPLACE_ERE || oper == RPN_MATCHES_ERE)
+		flags |= REG_EXTENDED;
+
+	return flags;
+}
+
+/*
+ * Executes replace_bre/ere or matches_bre/ere with already compiled pattern.
+ * args points to the first argument, which is replaced by the result.
+ */
+static int
+eval_regex(struct rpn_expression *exp, enum rpn_operator oper,
+		const struct csv_regex *preg, struct rpn_variant *args)
+{
+	const char *str = args[0].pchar;
+
+	if (oper == RPN_MATCHES_BRE || oper == RPN_MATCHES_ERE) {
+		args[0].type = RPN_LLONG;
+		args[0].llong = csv_regex_exec(preg, str, 0, NULL) == 0 ? 1 : 0;
+		return 0;
+	}
+
+#define MAX_MATCHES 9
+	regmatch_t matches[MAX_MATCHES + 1];
+	if (csv_regex_exec(preg, str, MAX_MATCHES, matches) == 0) {
+		size_t len = replace_re(str, args[2].pchar, matches,
+				&exp->buf, &exp->buf_size);
+		char *n = csv_arena_strndup(&exp->scratch, exp->buf, len);
+		if (!n)
+			return -1;
+		args[0].pchar = n;
+	}
+#undef MAX_MATCHES
+
+	return 0;
+}
+
+static int
+eval_oper(struct rpn_expression *exp, enum rpn_operator oper,
+		size_t *pheight)
 {
 	size_t height = *pheight;
-	struct rpn_variant *stack = *pstack;
+	struct rpn_variant *stack = exp->stack;
+	struct csv_arena *scratch = &exp->scratch;
 	enum rpn_variant_type type1, type2;
 
 	assert(ARRAY_SIZE(oper2txt) == RPN_MAX + 1);
@@ -726,13 +856,10 @@ eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
 
 		csv_substring_sanitize(str, &start, &len);
 
-		char *n = strndup(str + start, len);
-		if (!n) {
-			perror("strndup");
+		char *n = csv_arena_strndup(scratch, str + start, len);
+		if (!n)
 			return -1;
-		}
 
-		free(str);
 		stack[height - 1].pchar = n;
 
 		break;
@@ -740,8 +867,6 @@ eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
 	case RPN_STRLEN: {
 		long long ret = (long long)strlen(stack[height - 1].pchar);
 
-		free(stack[height - 1].pchar);
-
 		stack[height - 1].type = RPN_LLONG;
 		stack[height - 1].llong = ret;
 		break;
@@ -750,81 +875,27 @@ eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
 		char *str1, *str2;
 		str1 = stack[height - 1].pchar;
 		str2 = stack[height].pchar;
-		char *n = xmalloc(strlen(str1) + strlen(str2) + 1, 1);
+		size_t len1 = strlen(str1);
+		size_t len2 = strlen(str2);
+		char *n = csv_arena_alloc(scratch, len1 + len2 + 1);
 		if (!n)
 			return -1;
-		strcpy(n, str1);
-		strcat(n, str2);
+		memcpy(n, str1, len1);
+		memcpy(n + len1, str2, len2 + 1);
 
-		free(str1);
-		free(str2);
 		stack[height - 1].pchar = n;
 
 		break;
 	}
 	case RPN_LIKE: {
-		char *str, *pattern;
-		str = stack[height - 1].pchar;
-		pattern = stack[height].pchar;
-		size_t patlen = strlen(pattern);
-
-		char *n = xmalloc(patlen * 3, 1);
-		if (!n)
+		const struct like_pattern *p =
+				like_compile(scratch, stack[height].pchar);
+		if (!p)
 			return -1;
 
-		char *o = n;
-		static const char escape[256] = {
-				['.'] = 1,
-				['?'] = 1,
-				['*'] = 1,
-				['+'] = 1,
-				['['] = 1,
-				[']'] = 1,
-				['('] = 1,
-				[')'] = 1,
-				['$'] = 1,
-				['^'] = 1,
-				['\\'] = 1,
-				['|'] = 1,
-		};
-
-		*o++ = '^';
-
-		const char *c = pattern;
-		while (*c) {
-			if (*c == '%') {
-				*o++ = '.';
-				*o++ = '*';
-				c++;
-			} else if (escape[(unsigned char)*c]) {
-				*o++ = '\\';
-				*o++ = *c++;
-			} else {
-				*o++ = *c++;
-			}
-		}
-
-		*o++ = '$';
-		*o++ = 0;
-
-		regex_t *preg;
-
-		int ret = csv_regex_get(&preg, n, REG_EXTENDED | REG_NOSUB);
-		if (ret) {
-			free(n);
-			return -1;
-		}
-
-		if (regexec(preg, str, 0, NULL, 0) == 0)
-			stack[height - 1].llong = 1;
-		else
-			stack[height - 1].llong = 0;
+		stack[height - 1].llong = like_match(p, stack[height - 1].pchar);
 		stack[height - 1].type = RPN_LLONG;
 
-		free(str);
-		free(pattern);
-		free(n);
-
 		break;
 	}
 	case RPN_TOFLOAT: {
@@ -837,8 +908,6 @@ eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
 			const char *str = stack[height - 1].pchar;
 			if (strtod_safe(str, &dbl) < 0)
 				return -1;
-
-			free(stack[height - 1].pchar);
 		} else {
 			abort();
 		}
@@ -859,8 +928,6 @@ eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
 
 			if (strtoll_safe(str, &val, 0) < 0)
 				return -1;
-
-			free(stack[height - 1].pchar);
 		} else {
 			abort();
 		}
@@ -873,14 +940,15 @@ eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
 	case RPN_TOSTRING: {
 		char *str;
 		if (type1 == RPN_LLONG) {
-			str = tostring(stack[height - 1].llong, 10);
+			str = tostring(scratch, stack[height - 1].llong, 10);
 			if (!str)
 				return -1;
 		} else if (type1 == RPN_DOUBLE) {
-			if (csv_asprintf(&str, "%f", stack[height - 1].dbl) < 0) {
-				perror("asprintf");
+			char buf[CSV_NUMBER_BUF_SIZE];
+			csv_format_double(buf, stack[height - 1].dbl);
+			str = csv_arena_strndup(scratch, buf, strlen(buf));
+			if (!str)
 				return -1;
-			}
 		} else if (type1 == RPN_PCHAR) {
 			str = stack[height - 1].pchar;
 		} else {
@@ -895,7 +963,7 @@ eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
 	case RPN_INT2STRB: {
 		long long val = stack[height - 1].llong;
 		long long base = stack[height].llong;
-		char *str = tostring(val, base);
+		char *str = tostring(scratch, val, base);
 		if (!str)
 			return -1;
 
@@ -912,15 +980,13 @@ eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
 		if (strtoll_safe(str, &ret, base) < 0)
 			return -1;
 
-		free(stack[height - 1].pchar);
-
 		stack[height - 1].type = RPN_LLONG;
 		stack[height - 1].llong = ret;
 		break;
 	}
 	case RPN_INT2STR: {
 		long long val = stack[height - 1].llong;
-		char *str = tostring(val, 10);
+		char *str = tostring(scratch, val, 10);
 		if (!str)
 			return -1;
 
@@ -936,8 +1002,6 @@ eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
 		if (strtoll_safe(str, &ret, 0) < 0)
 			return -1;
 
-		free(stack[height - 1].pchar);
-
 		stack[height - 1].type = RPN_LLONG;
 		stack[height - 1].llong = ret;
 		break;
@@ -955,11 +1019,11 @@ eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
 		break;
 	}
 	case RPN_FLT2STR: {
-		char *str;
-		if (csv_asprintf(&str, "%f", stack[height - 1].dbl) < 0) {
-			perror("asprintf");
+		char buf[CSV_NUMBER_BUF_SIZE];
+		csv_format_double(buf, stack[height - 1].dbl);
+		char *str = csv_arena_strndup(scratch, buf, strlen(buf));
+		if (!str)
 			return -1;
-		}
 
 		stack[height - 1].type = RPN_PCHAR;
 		stack[height - 1].pchar = str;
@@ -971,8 +1035,6 @@ eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
 		if (strtod_safe(stack[height - 1].pchar, &dbl))
 			return -1;
 
-		free(stack[height - 1].pchar);
-
 		stack[height - 1].type = RPN_DOUBLE;
 		stack[height - 1].dbl = dbl;
 
@@ -994,9 +1056,6 @@ eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
 			assert(type1 == RPN_PCHAR);
 			int ret = strcmp(stack[height - 1].pchar, stack[height].pchar) < 0 ? 1 : 0;
 
-			free(stack[height - 1].pchar);
-			free(stack[height].pchar);
-
 			stack[height - 1].type = RPN_LLONG;
 			stack[height - 1].llong = ret;
 		}
@@ -1017,9 +1076,6 @@ eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
 			assert(type1 == RPN_PCHAR);
 			int ret = strcmp(stack[height - 1].pchar, stack[height].pchar) <= 0 ? 1 : 0;
 
-			free(stack[height - 1].pchar);
-			free(stack[height].pchar);
-
 			stack[height - 1].type = RPN_LLONG;
 			stack[height - 1].llong = ret;
 		}
@@ -1040,9 +1096,6 @@ eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
 			assert(type1 == RPN_PCHAR);
 			int ret = strcmp(stack[height - 1].pchar, stack[height].pchar) > 0 ? 1 : 0;
 
-			free(stack[height - 1].pchar);
-			free(stack[height].pchar);
-
 			stack[height - 1].type = RPN_LLONG;
 			stack[height - 1].llong = ret;
 		}
@@ -1063,9 +1116,6 @@ eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
 			assert(type1 == RPN_PCHAR);
 			int ret = strcmp(stack[height - 1].pchar, stack[height].pchar) >= 0 ? 1 : 0;
 
-			free(stack[height - 1].pchar);
-			free(stack[height].pchar);
-
 			stack[height - 1].type = RPN_LLONG;
 			stack[height - 1].llong = ret;
 		}
@@ -1086,9 +1136,6 @@ eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
 			assert(type1 == RPN_PCHAR);
 			int ret = strcmp(stack[height - 1].pchar, stack[height].pchar) == 0 ? 1 : 0;
 
-			free(stack[height - 1].pchar);
-			free(stack[height].pchar);
-
 			stack[height - 1].type = RPN_LLONG;
 			stack[height - 1].llong = ret;
 		}
@@ -1109,23 +1156,15 @@ eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
 			assert(type1 == RPN_PCHAR);
 			int ret = strcmp(stack[height - 1].pchar, stack[height].pchar) != 0 ? 1 : 0;
 
-			free(stack[height - 1].pchar);
-			free(stack[height].pchar);
-
 			stack[height - 1].type = RPN_LLONG;
 			stack[height - 1].llong = ret;
 		}
 		break;
 	case RPN_IF:
-		if (stack[height - 1].llong) {
+		if (stack[height - 1].llong)
 			stack[height - 1] = stack[height];
-			if (stack[height + 1].type == RPN_PCHAR)
-				free(stack[height + 1].pchar);
-		} else {
+		else
 			stack[height - 1] = stack[height + 1];
-			if (stack[height].type == RPN_PCHAR)
-				free(stack[height].pchar);
-		}
 
 		break;
 	case RPN_REPLACE: {
@@ -1133,157 +1172,1025 @@ eval_oper(enum rpn_operator oper, struct rpn_variant **pstack, size_t *pheight)
 		char *pattern = stack[height].pchar;
 		char *replacement = stack[height + 1].pchar;
 		long long case_sensitive = stack[height + 2].llong;
-		char *buf = NULL;
-		size_t buflen = 0;
 
 		if (csv_str_replace(str, pattern, replacement, case_sensitive,
-				&buf, &buflen)) {
-			stack[height - 1].pchar = buf;
-			free(str);
-		} else {
-			stack[height - 1].pchar = str;
-			free(buf);
+				&exp->buf, &exp->buf_size)) {
+			char *n = csv_arena_strndup(scratch, exp->buf,
+					strlen(exp->buf));
+			if (!n)
+				return -1;
+			stack[height - 1].pchar = n;
 		}
 
-		free(pattern);
-		free(replacement);
-
 		break;
 	}
 	case RPN_REPLACE_BRE:
-	case RPN_REPLACE_ERE: {
-		char *str = stack[height - 1].pchar;
-		char *pattern = stack[height].pchar;
-		char *replacement = stack[height + 1].pchar;
-		long long case_sensitive = stack[height + 2].llong;
-
-		regex_t *preg;
+	case RPN_REPLACE_ERE:
+	case RPN_MATCHES_BRE:
+	case RPN_MATCHES_ERE: {
+		struct csv_regex *preg;
+		long long case_sensitive =
+				oper == RPN_REPLACE_BRE || oper == RPN_REPLACE_ERE ?
+				stack[height + 2].llong : stack[height + 1].llong;
 
-		int ret = csv_regex_get(&preg, pattern,
-				(case_sensitive ? 0 : REG_ICASE) |
-				(oper == RPN_REPLACE_ERE ? REG_EXTENDED : 0));
+		int ret = csv_regex_get(&preg, stack[height].pchar,
+				regex_flags(oper, case_sensitive));
 		if (ret)
 			return -1;
 
-#define MAX_MATCHES 9
-		regmatch_t matches[MAX_MATCHES + 1];
-		if (regexec(preg, str, MAX_MATCHES, matches, 0) == 0) {
-			stack[height - 1].pchar =
-					replace_re(str, replacement, matches);
-			free(str);
-		} else {
-			stack[height - 1].pchar = str;
-		}
-#undef MAX_MATCHES
+		if (eval_regex(exp, oper, preg, &stack[height - 1]))
+			return -1;
 
-		free(pattern);
-		free(replacement);
+		break;
+	}
+	case RPN_NEXT: {
+		char *name = stack[height - 1].pchar;
+
+		stack[height - 1].type = RPN_LLONG;
+		stack[height - 1].llong = next(name);
 
 		break;
 	}
-	case RPN_MATCHES_BRE:
-	case RPN_MATCHES_ERE: {
-		char *str = stack[height - 1].pchar;
-		char *pattern = stack[height].pchar;
-		long long case_sensitive = stack[height + 1].llong;
+	default:
+		abort();
+	}
 
-		regex_t *preg;
+	*pheight = height;
 
-		int ret = csv_regex_get(&preg, pattern,
-				REG_NOSUB |
-				(case_sensitive ? 0 : REG_ICASE) |
-				(oper == RPN_MATCHES_ERE ? REG_EXTENDED : 0));
-		if (ret)
-			return -1;
-		free(pattern);
+	return 0;
+}
 
-		stack[height - 1].type = RPN_LLONG;
+/* number of stack entries consumed by each operator */
+static const unsigned char oper_args[] = {
+	[RPN_ADD] = 2,
+	[RPN_SUB] = 2,
+	[RPN_MUL] = 2,
+	[RPN_DIV] = 2,
+	[RPN_MOD] = 2,
+	[RPN_BIT_OR] = 2,
+	[RPN_BIT_AND] = 2,
+	[RPN_BIT_XOR] = 2,
+	[RPN_BIT_NEG] = 1,
+	[RPN_BIT_LSHIFT] = 2,
+	[RPN_BIT_RSHIFT] = 2,
+	[RPN_SUBSTR] = 3,
+	[RPN_STRLEN] = 1,
+	[RPN_CONCAT] = 2,
+	[RPN_LIKE] = 2,
+	[RPN_TOFLOAT] = 1,
+	[RPN_TOINT] = 1,
+	[RPN_TOSTRING] = 1,
+	[RPN_INT2STR] = 1,
+	[RPN_INT2STRB] = 2,
+	[RPN_INT2FLT] = 1,
+	[RPN_STR2INT] = 1,
+	[RPN_STRB2INT] = 2,
+	[RPN_STR2FLT] = 1,
+	[RPN_FLT2INT] = 1,
+	[RPN_FLT2STR] = 1,
+	[RPN_LT] = 2,
+	[RPN_LE] = 2,
+	[RPN_GT] = 2,
+	[RPN_GE] = 2,
+	[RPN_EQ] = 2,
+	[RPN_NE] = 2,
+	[RPN_LOGIC_OR] = 2,
+	[RPN_LOGIC_AND] = 2,
+	[RPN_LOGIC_NOT] = 1,
+	[RPN_LOGIC_XOR] = 2,
+	[RPN_IF] = 3,
+	[RPN_REPLACE] = 4,
+	[RPN_REPLACE_BRE] = 4,
+	[RPN_REPLACE_ERE] = 4,
+	[RPN_MATCHES_BRE] = 3,
+	[RPN_MATCHES_ERE] = 3,
+	[RPN_NEXT] = 1,
+};
+
+enum rpn_opcode {
+	OP_GENERIC,		/* eval_oper */
+	OP_LOAD_INT_COL,
+	OP_LOAD_FLT_COL,
+	OP_LOAD_STR_COL,
+	OP_PUSH,		/* constant */
+
+#define NUM_OPCODES(name) \
+	OP_##name##_INT_INT, OP_##name##_INT_FLT, \
+	OP_##name##_FLT_INT, OP_##name##_FLT_FLT
+#define CMP_OPCODES(name) NUM_OPCODES(name), OP_##name##_STR_STR
+
+	NUM_OPCODES(ADD),
+	NUM_OPCODES(SUB),
+	NUM_OPCODES(MUL),
+	NUM_OPCODES(DIV),
+	NUM_OPCODES(MOD),
+
+	CMP_OPCODES(LT),
+	CMP_OPCODES(LE),
+	CMP_OPCODES(GT),
+	CMP_OPCODES(GE),
+	CMP_OPCODES(EQ),
+	CMP_OPCODES(NE),
+
+#undef CMP_OPCODES
+#undef NUM_OPCODES
+
+	OP_BIT_OR,
+	OP_BIT_AND,
+	OP_BIT_XOR,
+	OP_BIT_NEG,
+	OP_BIT_LSHIFT,
+	OP_BIT_RSHIFT,
+
+	OP_JUMP,		/* skip "skip" instructions */
+	OP_AND_JUMP,		/* skip if top of the stack is 0 */
+	OP_OR_JUMP,		/* skip if top of the stack is 1 */
+	OP_IF_JUMP,		/* pop, skip if it was 0 */
+
+	OP_LIKE,		/* like with constant pattern */
+	OP_REGEX,		/* regex operator with constant pattern */
+};
+
+struct rpn_insn {
+	enum rpn_opcode op;
+	union {
+		size_t col;
+		enum rpn_operator oper;
+		struct rpn_variant constant;
+		size_t skip;
+		const struct like_pattern *like;
+		struct {
+			enum rpn_operator oper;
+			const struct csv_regex *preg;
+		} regex;
+	};
+};
 
-		if (regexec(preg, str, 0, NULL, 0) == 0)
-			stack[height - 1].llong = 1;
+/*
+ * First opcode of specialized variants of operators. Numeric operators have
+ * 4 variants (int/float for each argument), comparisons also have a string
+ * one. Operators missing here are executed by eval_oper.
+ */
+static const enum rpn_opcode typed_oper[RPN_MAX + 1] = {
+	[RPN_ADD] = OP_ADD_INT_INT,
+	[RPN_SUB] = OP_SUB_INT_INT,
+	[RPN_MUL] = OP_MUL_INT_INT,
+	[RPN_DIV] = OP_DIV_INT_INT,
+	[RPN_MOD] = OP_MOD_INT_INT,
+	[RPN_LT] = OP_LT_INT_INT,
+	[RPN_LE] = OP_LE_INT_INT,
+	[RPN_GT] = OP_GT_INT_INT,
+	[RPN_GE] = OP_GE_INT_INT,
+	[RPN_EQ] = OP_EQ_INT_INT,
+	[RPN_NE] = OP_NE_INT_INT,
+	[RPN_BIT_OR] = OP_BIT_OR,
+	[RPN_BIT_AND] = OP_BIT_AND,
+	[RPN_BIT_XOR] = OP_BIT_XOR,
+	[RPN_BIT_NEG] = OP_BIT_NEG,
+	[RPN_BIT_LSHIFT] = OP_BIT_LSHIFT,
+	[RPN_BIT_RSHIFT] = OP_BIT_RSHIFT,
+};
+
+/*
+ * Static version of type checks done by eval_oper. Returns false if types
+ * of arguments are not valid for the operator.
+ */
+static bool
+oper_type(enum rpn_operator oper, const enum rpn_variant_type *args,
+		enum rpn_variant_type *ret)
+{
+	switch (oper) {
+	case RPN_ADD:
+	case RPN_SUB:
+	case RPN_MUL:
+	case RPN_DIV:
+	case RPN_MOD:
+		if (!is_numeric(args[0]) || !is_numeric(args[1]))
+			return false;
+		if (args[0] == RPN_LLONG && args[1] == RPN_LLONG)
+			*ret = RPN_LLONG;
 		else
-			stack[height - 1].llong = 0;
+			*ret = RPN_DOUBLE;
+		return true;
+	case RPN_BIT_OR:
+	case RPN_BIT_AND:
+	case RPN_BIT_XOR:
+	case RPN_BIT_LSHIFT:
+	case RPN_BIT_RSHIFT:
+	case RPN_LOGIC_AND:
+	case RPN_LOGIC_OR:
+	case RPN_LOGIC_XOR:
+		*ret = RPN_LLONG;
+		return args[0] == RPN_LLONG && args[1] == RPN_LLONG;
+	case RPN_BIT_NEG:
+	case RPN_LOGIC_NOT:
+		*ret = RPN_LLONG;
+		return args[0] == RPN_LLONG;
+	case RPN_SUBSTR:
+		*ret = RPN_PCHAR;
+		return args[0] == RPN_PCHAR && args[1] == RPN_LLONG &&
+				args[2] == RPN_LLONG;
+	case RPN_CONCAT:
+		*ret = RPN_PCHAR;
+		return args[0] == RPN_PCHAR && args[1] == RPN_PCHAR;
+	case RPN_LIKE:
+		*ret = RPN_LLONG;
+		return args[0] == RPN_PCHAR && args[1] == RPN_PCHAR;
+	case RPN_STRLEN:
+		*ret = RPN_LLONG;
+		return args[0] == RPN_PCHAR;
+	case RPN_TOFLOAT:
+		*ret = RPN_DOUBLE;
+		return true;
+	case RPN_TOINT:
+		*ret = RPN_LLONG;
+		return true;
+	case RPN_TOSTRING:
+		*ret = RPN_PCHAR;
+		return true;
+	case RPN_INT2STRB:
+		*ret = RPN_PCHAR;
+		return args[0] == RPN_LLONG && args[1] == RPN_LLONG;
+	case RPN_STRB2INT:
+		*ret = RPN_LLONG;
+		return args[0] == RPN_PCHAR && args[1] == RPN_LLONG;
+	case RPN_INT2STR:
+		*ret = RPN_PCHAR;
+		return args[0] == RPN_LLONG;
+	case RPN_STR2INT:
+		*ret = RPN_LLONG;
+		return args[0] == RPN_PCHAR;
+	case RPN_INT2FLT:
+		*ret = RPN_DOUBLE;
+		return args[0] == RPN_LLONG;
+	case RPN_FLT2INT:
+		*ret = RPN_LLONG;
+		return args[0] == RPN_DOUBLE;
+	case RPN_FLT2STR:
+		*ret = RPN_PCHAR;
+		return args[0] == RPN_DOUBLE;
+	case RPN_STR2FLT:
+		*ret = RPN_DOUBLE;
+		return args[0] == RPN_PCHAR;
+	case RPN_LT:
+	case RPN_LE:
+	case RPN_GT:
+	case RPN_GE:
+	case RPN_EQ:
+	case RPN_NE:
+		*ret = RPN_LLONG;
+		return is_numeric(args[0]) == is_numeric(args[1]);
+	case RPN_IF:
+		*ret = args[1];
+		return args[0] == RPN_LLONG && args[1] == args[2];
+	case RPN_REPLACE:
+	case RPN_REPLACE_BRE:
+	case RPN_REPLACE_ERE:
+		*ret = RPN_PCHAR;
+		return args[0] == RPN_PCHAR && args[1] == RPN_PCHAR &&
+				args[2] == RPN_PCHAR && args[3] == RPN_LLONG;
+	case RPN_MATCHES_BRE:
+	case RPN_MATCHES_ERE:
+		*ret = RPN_LLONG;
+		return args[0] == RPN_PCHAR && args[1] == RPN_PCHAR &&
+				args[2] == RPN_LLONG;
+	case RPN_NEXT:
+		*ret = RPN_LLONG;
+		return args[0] == RPN_PCHAR;
+	default:
+		abort();
+	}
+}
 
-		free(str);
+static bool
+is_bool(const struct rpn_variant *v)
+{
+	return v->llong == 0 || v->llong == 1;
+}
 
-		break;
+/*
+ * Returns true if operator applied to constant arguments can be evaluated
+ * once, at compile time. Operators with side effects or which might fail
+ * (and print an error) are left for runtime.
+ */
+static bool
+can_fold(enum rpn_operator oper, const struct rpn_variant *args)
+{
+	switch (oper) {
+	case RPN_ADD:
+	case RPN_SUB:
+	case RPN_MUL:
+	case RPN_BIT_OR:
+	case RPN_BIT_AND:
+	case RPN_BIT_XOR:
+	case RPN_BIT_NEG:
+	case RPN_BIT_LSHIFT:
+	case RPN_BIT_RSHIFT:
+	case RPN_LT:
+	case RPN_LE:
+	case RPN_GT:
+	case RPN_GE:
+	case RPN_EQ:
+	case RPN_NE:
+	case RPN_IF:
+	case RPN_CONCAT:
+	case RPN_LIKE:
+	case RPN_STRLEN:
+	case RPN_TOSTRING:
+	case RPN_INT2STR:
+	case RPN_INT2FLT:
+	case RPN_FLT2INT:
+	case RPN_FLT2STR:
+	case RPN_REPLACE:
+		return true;
+	case RPN_DIV:
+	case RPN_MOD:
+		if (args[1].type == RPN_LLONG)
+			return args[1].llong != 0;
+		return args[1].dbl != 0.0;
+	case RPN_LOGIC_AND:
+	case RPN_LOGIC_OR:
+	case RPN_LOGIC_XOR:
+		return is_bool(&args[0]) && is_bool(&args[1]);
+	case RPN_LOGIC_NOT:
+		return is_bool(&args[0]);
+	case RPN_SUBSTR:
+		return args[2].llong >= 0;
+	case RPN_INT2STRB:
+		return args[1].llong == 2 || args[1].llong == 8 ||
+				args[1].llong == 10 || args[1].llong == 16;
+	case RPN_TOFLOAT:
+	case RPN_TOINT:
+		return args[0].type != RPN_PCHAR;
+	default:
+		return false;
 	}
-	case RPN_NEXT: {
-		char *name = stack[height - 1].pchar;
+}
 
-		stack[height - 1].type = RPN_LLONG;
-		stack[height - 1].llong = next(name);
+/* rough relative cost of operators, used to order terms of and/or */
+static unsigned
+oper_cost(enum rpn_operator oper)
+{
+	switch (oper) {
+	case RPN_REPLACE_BRE:
+	case RPN_REPLACE_ERE:
+	case RPN_MATCHES_BRE:
+	case RPN_MATCHES_ERE:
+		return 50;
+	case RPN_SUBSTR:
+	case RPN_CONCAT:
+	case RPN_LIKE:
+	case RPN_REPLACE:
+	case RPN_TOSTRING:
+	case RPN_INT2STR:
+	case RPN_INT2STRB:
+	case RPN_FLT2STR:
+	case RPN_NEXT:
+		return 10;
+	case RPN_STRLEN:
+	case RPN_STR2INT:
+	case RPN_STRB2INT:
+	case RPN_STR2FLT:
+	case RPN_TOINT:
+	case RPN_TOFLOAT:
+		return 4;
+	default:
+		return 1;
+	}
+}
 
-		free(name);
+/* value on the stack at compile time */
+struct slot {
+	enum rpn_variant_type type;
+	bool constant;
+	/* code computing this value is code[start, start of the next slot) */
+	size_t start;
+	unsigned cost;
+	/* false if computing it has side effects */
+	bool pure;
+};
 
-		break;
+static void
+insert_insn(struct rpn_insn *code, size_t *ncode, size_t pos,
+		const struct rpn_insn *insn)
+{
+	memmove(&code[pos + 1], &code[pos], (*ncode - pos) * sizeof(code[0]));
+	code[pos] = *insn;
+	(*ncode)++;
+}
+
+/* swaps adjacent blocks code[a, b) and code[b, end) */
+static void
+swap_blocks(struct rpn_insn *code, size_t a, size_t b, size_t end)
+{
+	size_t len = b - a;
+	struct rpn_insn *tmp = xmalloc_nofail(len, sizeof(tmp[0]));
+
+	memcpy(tmp, &code[a], len * sizeof(code[0]));
+	memmove(&code[a], &code[b], (end - b) * sizeof(code[0]));
+	memcpy(&code[a + end - b], tmp, len * sizeof(code[0]));
+
+	free(tmp);
+}
+
+/*
+ * Emits short-circuiting code for and/or/if. Arguments are the last
+ * values on the stack and their code is at the end of "code".
+ * Returns false if the operator has to be executed normally.
+ */
+static bool
+emit_jumps(struct rpn_insn *code, size_t *ncode, enum rpn_operator oper,
+		struct slot *args)
+{
+	struct rpn_insn jump;
+
+	if (oper == RPN_LOGIC_AND || oper == RPN_LOGIC_OR) {
+		size_t mid = args[1].start;
+
+		/* cheaper term goes first, and/or are commutative */
+		if (args[0].pure && args[1].pure &&
+				args[1].cost < args[0].cost) {
+			swap_blocks(code, args[0].start, mid, *ncode);
+			mid = args[0].start + *ncode - mid;
+		}
+
+		/*
+		 * First term is left on the stack if it decides the result.
+		 * Otherwise the operator checks both values as usual.
+		 */
+		jump.op = oper == RPN_LOGIC_AND ? OP_AND_JUMP : OP_OR_JUMP;
+		jump.skip = *ncode - mid + 1;
+		insert_insn(code, ncode, mid, &jump);
+
+		return false;
 	}
-	default:
-		abort();
+
+	if (oper == RPN_IF) {
+		size_t then_start = args[1].start;
+		size_t else_start = args[2].start;
+
+		jump.op = OP_JUMP;
+		jump.skip = *ncode - else_start;
+		insert_insn(code, ncode, else_start, &jump);
+
+		jump.op = OP_IF_JUMP;
+		jump.skip = else_start - then_start + 1;
+		insert_insn(code, ncode, then_start, &jump);
+
+		return true;
 	}
 
-	stack = xrealloc(stack, height, sizeof(stack[0]));
-	if (!stack)
-		return -1;
+	return false;
+}
 
-	*pheight = height;
-	*pstack = stack;
+static bool
+is_regex_oper(enum rpn_operator oper)
+{
+	return oper == RPN_REPLACE_BRE || oper == RPN_REPLACE_ERE ||
+			oper == RPN_MATCHES_BRE || oper == RPN_MATCHES_ERE;
+}
+
+/*
+ * Compiles regular expression owned by the expression. Errors are not
+ * reported here - evaluation will report them on the first row.
+ */
+static const struct csv_regex *
+bind_regex(struct rpn_expression *exp, enum rpn_operator oper,
+		const char *pattern, long long case_sensitive)
+{
+	struct csv_regex *preg = &exp->regexes[exp->nregexes];
+
+	if (csv_regex_compile(preg, pattern, regex_flags(oper, case_sensitive)))
+		return NULL;
+
+	exp->nregexes++;
+	csv_regex_bound();
+
+	return preg;
+}
+
+static void
+free_regexes(struct rpn_expression *exp)
+{
+	for (size_t i = 0; i < exp->nregexes; ++i)
+		csv_regex_free(&exp->regexes[i]);
+	free(exp->regexes);
+	exp->regexes = NULL;
+	exp->nregexes = 0;
+}
+
+/*
+ * Translates tokens into typed code. Types of columns are resolved once,
+ * numeric operators and comparisons get opcodes specialized for their
+ * argument types and operators with constant arguments are evaluated.
+ * and/or/if skip evaluation of terms which can't change the result.
+ * Constant like and regex patterns are compiled here, once.
+ * Expressions which don't type check are left for the generic evaluator,
+ * so that errors are reported the same way as before.
+ */
+static void
+compile(struct rpn_expression *exp)
+{
+	exp->code = NULL;
+	exp->ncode = 0;
+	exp->regexes = NULL;
+	exp->nregexes = 0;
+
+	if (exp->count == 0)
+		return;
+
+	/* every token produces at most 2 instructions (if) */
+	struct rpn_insn *code = xmalloc_nofail(exp->count * 2, sizeof(code[0]));
+	struct slot *slots = xmalloc_nofail(exp->max_height, sizeof(slots[0]));
+	size_t ncode = 0;
+	size_t height = 0;
+	bool typed = true;
+
+	size_t nregexes = 0;
+	for (size_t i = 0; i < exp->count; ++i) {
+		if (exp->tokens[i].type == RPN_OPERATOR &&
+				is_regex_oper(exp->tokens[i].operator))
+			nregexes++;
+	}
+	if (nregexes)
+		exp->regexes = xmalloc_nofail(nregexes,
+				sizeof(exp->regexes[0]));
+
+	for (size_t i = 0; i < exp->count; ++i) {
+		const struct rpn_token *t = &exp->tokens[i];
+		struct rpn_insn *insn = &code[ncode];
+		struct slot *slot;
+
+		if (t->type != RPN_OPERATOR) {
+			slot = &slots[height];
+			slot->start = ncode;
+			slot->constant = false;
+			slot->cost = 1;
+			slot->pure = true;
+		}
+
+		if (t->type == RPN_CONSTANT) {
+			insn->op = OP_PUSH;
+			insn->constant = t->constant;
+			slot->type = t->constant.type;
+			slot->constant = true;
+			slot->cost = 0;
+			height++;
+			ncode++;
+			continue;
+		}
+
+		if (t->type == RPN_COLUMN) {
+			if (strcmp(t->col.type, "int") == 0) {
+				insn->op = OP_LOAD_INT_COL;
+				slot->type = RPN_LLONG;
+			} else if (strcmp(t->col.type, "float") == 0) {
+				insn->op = OP_LOAD_FLT_COL;
+				slot->type = RPN_DOUBLE;
+			} else if (strcmp(t->col.type, "string") == 0) {
+				insn->op = OP_LOAD_STR_COL;
+				slot->type = RPN_PCHAR;
+			} else {
+				typed = false;
+				break;
+			}
+			insn->col = t->col.num;
+			height++;
+			ncode++;
+			continue;
+		}
+
+		assert(t->type == RPN_OPERATOR);
+
+		enum rpn_operator oper = t->operator;
+		size_t nargs = oper_args[oper];
+		if (height < nargs) {
+			typed = false;
+			break;
+		}
+
+		struct slot *args = &slots[height - nargs];
+		enum rpn_variant_type arg_types[4];
+		enum rpn_variant_type ret;
+		bool constant = true;
+		unsigned cost = oper_cost(oper);
+		bool pure = oper != RPN_NEXT;
+		const struct csv_regex *preg;
+
+		for (size_t j = 0; j < nargs; ++j) {
+			arg_types[j] = args[j].type;
+			constant &= args[j].constant;
+			cost += args[j].cost;
+			pure &= args[j].pure;
+		}
+
+		if (!oper_type(oper, arg_types, &ret)) {
+			typed = false;
+			break;
+		}
+
+		/* constant arguments are always pushed by the last instructions */
+		if (constant) {
+			struct rpn_insn *first = &code[ncode - nargs];
+			for (size_t j = 0; j < nargs; ++j)
+				exp->stack[j] = first[j].constant;
+		}
+
+		if (constant && can_fold(oper, exp->stack)) {
+			size_t h = nargs;
+			if (eval_oper(exp, oper, &h))
+				abort();
+
+			struct rpn_variant *v = &exp->stack[0];
+			if (v->type == RPN_PCHAR) {
+				v->pchar = csv_arena_strndup(&exp->consts,
+						v->pchar, strlen(v->pchar));
+				if (!v->pchar)
+					exit(2);
+			}
+
+			ncode -= nargs;
+			insn = &code[ncode];
+			insn->op = OP_PUSH;
+			insn->constant = *v;
+			ncode++;
+			cost = 0;
+		} else if (emit_jumps(code, &ncode, oper, args)) {
+			constant = false;
+		} else if (oper == RPN_LIKE && args[1].constant) {
+			/* pattern is pushed by the last instruction */
+			constant = false;
+			insn = &code[ncode - 1];
+			insn->like = like_compile(&exp->consts,
+					insn->constant.pchar);
+			if (!insn->like)
+				exit(2);
+			insn->op = OP_LIKE;
+		} else if (is_regex_oper(oper) && args[1].constant &&
+				args[nargs - 1].constant &&
+				(preg = bind_regex(exp, oper,
+					code[args[1].start].constant.pchar,
+					code[args[nargs - 1].start].constant.llong))) {
+			constant = false;
+			insn = &code[ncode];
+			insn->op = OP_REGEX;
+			insn->regex.oper = oper;
+			insn->regex.preg = preg;
+			ncode++;
+		} else {
+			constant = false;
+			insn = &code[ncode];
+			insn->op = typed_oper[oper];
+			if (insn->op == OP_GENERIC) {
+				insn->oper = oper;
+			} else if (insn->op < OP_BIT_OR) {
+				/* pick variant for argument types */
+				unsigned variant = 4; /* strings */
+				if (is_numeric(arg_types[0]))
+					variant = (arg_types[0] == RPN_DOUBLE) * 2U +
+						(arg_types[1] == RPN_DOUBLE);
+				insn->op = (enum rpn_opcode)(insn->op + variant);
+			}
+			ncode++;
+		}
+
+		height -= nargs;
+		slot = &slots[height];
+		/* start stays the same - it's the start of the first argument */
+		slot->type = ret;
+		slot->constant = constant;
+		slot->cost = cost;
+		slot->pure = pure;
+		height++;
+	}
+
+	csv_arena_reset(&exp->scratch);
+	free(slots);
+
+	if (!typed || height != 1) {
+		free(code);
+		free_regexes(exp);
+		return;
+	}
+
+	/*
+	 * Reordering of and/or terms might have changed stack usage.
+	 * Both branches of "if" are counted here, so it's an upper bound.
+	 */
+	size_t max_height = 0;
+	height = 0;
+	for (size_t i = 0; i < ncode; ++i) {
+		enum rpn_opcode op = code[i].op;
+
+		if (op == OP_PUSH || op == OP_LOAD_INT_COL ||
+				op == OP_LOAD_FLT_COL || op == OP_LOAD_STR_COL)
+			height++;
+		else if (op == OP_GENERIC)
+			height -= oper_args[code[i].oper] - 1;
+		else if (op == OP_REGEX)
+			height -= oper_args[code[i].regex.oper] - 1;
+		else if (op < OP_BIT_NEG || op == OP_BIT_LSHIFT ||
+				op == OP_BIT_RSHIFT || op == OP_IF_JUMP)
+			height--;
+
+		if (height > max_height)
+			max_height = height;
+	}
+
+	if (max_height > exp->max_height) {
+		exp->stack = xrealloc_nofail(exp->stack, max_height,
+				sizeof(exp->stack[0]));
+		exp->max_height = max_height;
+	}
+
+	exp->code = code;
+	exp->ncode = ncode;
+}
+
+/*
+ * Allocates evaluation state and compiles the expression. Stack size is
+ * the maximum height reached by the expression. Operators always leave one
+ * value on the stack, so the stack can't grow past that.
+ */
+void
+rpn_prepare(struct rpn_expression *exp)
+{
+	size_t height = 0;
+	size_t max_height = 1;
+
+	assert(ARRAY_SIZE(oper_args) == RPN_MAX + 1);
+
+	for (size_t i = 0; i < exp->count; ++i) {
+		const struct rpn_token *t = &exp->tokens[i];
+
+		if (t->type == RPN_OPERATOR) {
+			size_t args = oper_args[t->operator];
+			/* underflow is reported by rpn_eval */
+			if (height >= args)
+				height -= args - 1;
+		} else {
+			height++;
+			if (height > max_height)
+				max_height = height;
+		}
+	}
+
+	exp->stack = xmalloc_nofail(max_height, sizeof(exp->stack[0]));
+	exp->max_height = max_height;
+	csv_arena_init(&exp->scratch, 4096);
+	csv_arena_init(&exp->consts, 256);
+	exp->buf = NULL;
+	exp->buf_size = 0;
+
+	compile(exp);
+}
+
+#define NUM_CASES(name, op) \
+	case OP_##name##_INT_INT: \
+		height--; \
+		stack[height - 1].llong = stack[height - 1].llong op stack[height].llong; \
+		break; \
+	case OP_##name##_INT_FLT: \
+		height--; \
+		stack[height - 1].dbl = (double)stack[height - 1].llong op stack[height].dbl; \
+		stack[height - 1].type = RPN_DOUBLE; \
+		break; \
+	case OP_##name##_FLT_INT: \
+		height--; \
+		stack[height - 1].dbl = stack[height - 1].dbl op stack[height].llong; \
+		break; \
+	case OP_##name##_FLT_FLT: \
+		height--; \
+		stack[height - 1].dbl = stack[height - 1].dbl op stack[height].dbl; \
+		break;
+
+#define CMP_CASES(name, op) \
+	case OP_##name##_INT_INT: \
+		height--; \
+		stack[height - 1].llong = stack[height - 1].llong op stack[height].llong ? 1 : 0; \
+		break; \
+	case OP_##name##_INT_FLT: \
+		height--; \
+		stack[height - 1].llong = stack[height - 1].llong op stack[height].dbl ? 1 : 0; \
+		break; \
+	case OP_##name##_FLT_INT: \
+		height--; \
+		stack[height - 1].llong = stack[height - 1].dbl op stack[height].llong ? 1 : 0; \
+		stack[height - 1].type = RPN_LLONG; \
+		break; \
+	case OP_##name##_FLT_FLT: \
+		height--; \
+		stack[height - 1].llong = stack[height - 1].dbl op stack[height].dbl ? 1 : 0; \
+		stack[height - 1].type = RPN_LLONG; \
+		break; \
+	case OP_##name##_STR_STR: \
+		height--; \
+		stack[height - 1].llong = strcmp(stack[height - 1].pchar, stack[height].pchar) op 0 ? 1 : 0; \
+		stack[height - 1].type = RPN_LLONG; \
+		break;
+
+static int
+run(struct rpn_expression *exp, struct csv_values *row)
+{
+	struct rpn_variant *stack = exp->stack;
+	size_t height = 0;
+
+	for (size_t i = 0; i < exp->ncode; ++i) {
+		const struct rpn_insn *insn = &exp->code[i];
+
+		switch (insn->op) {
+		case OP_GENERIC:
+			if (eval_oper(exp, insn->oper, &height))
+				return -1;
+			break;
+		case OP_LOAD_INT_COL:
+			stack[height].type = RPN_LLONG;
+			if (csv_values_int(row, insn->col, &stack[height].llong))
+				return -1;
+			height++;
+			break;
+		case OP_LOAD_FLT_COL:
+			stack[height].type = RPN_DOUBLE;
+			if (csv_values_float(row, insn->col, &stack[height].dbl))
+				return -1;
+			height++;
+			break;
+		case OP_LOAD_STR_COL:
+			stack[height].type = RPN_PCHAR;
+			stack[height].pchar = (char *)csv_values_str(row, insn->col);
+			height++;
+			break;
+		case OP_PUSH:
+			stack[height++] = insn->constant;
+			break;
+
+		NUM_CASES(ADD, +)
+		NUM_CASES(SUB, -)
+		NUM_CASES(MUL, *)
+
+		case OP_DIV_INT_INT:
+		case OP_DIV_FLT_INT:
+		case OP_MOD_INT_INT:
+		case OP_MOD_FLT_INT:
+			if (stack[height - 1].llong == 0) {
+				fprintf(stderr, insn->op == OP_DIV_INT_INT ||
+						insn->op == OP_DIV_FLT_INT ?
+						"division by 0\n" : "modulo 0\n");
+				return -1;
+			}
+			if (insn->op == OP_DIV_INT_INT) {
+				height--;
+				stack[height - 1].llong /= stack[height].llong;
+			} else if (insn->op == OP_DIV_FLT_INT) {
+				height--;
+				stack[height - 1].dbl /= stack[height].llong;
+			} else if (insn->op == OP_MOD_INT_INT) {
+				height--;
+				stack[height - 1].llong %= stack[height].llong;
+			} else {
+				height--;
+				stack[height - 1].dbl = fmod(stack[height - 1].dbl,
+						stack[height].llong);
+			}
+			break;
+		case OP_DIV_INT_FLT:
+		case OP_DIV_FLT_FLT:
+		case OP_MOD_INT_FLT:
+		case OP_MOD_FLT_FLT:
+			if (stack[height - 1].dbl == 0.0) {
+				fprintf(stderr, insn->op == OP_DIV_INT_FLT ||
+						insn->op == OP_DIV_FLT_FLT ?
+						"division by 0.0\n" : "modulo 0.0\n");
+				return -1;
+			}
+			height--;
+			if (stack[height - 1].type == RPN_LLONG) {
+				stack[height - 1].dbl = stack[height - 1].llong;
+				stack[height - 1].type = RPN_DOUBLE;
+			}
+			if (insn->op == OP_DIV_INT_FLT || insn->op == OP_DIV_FLT_FLT)
+				stack[height - 1].dbl /= stack[height].dbl;
+			else
+				stack[height - 1].dbl = fmod(stack[height - 1].dbl,
+						stack[height].dbl);
+			break;
+
+		CMP_CASES(LT, <)
+		CMP_CASES(LE, <=)
+		CMP_CASES(GT, >)
+		CMP_CASES(GE, >=)
+		CMP_CASES(EQ, ==)
+		CMP_CASES(NE, !=)
+
+		case OP_BIT_OR:
+			height--;
+			stack[height - 1].llong |= stack[height].llong;
+			break;
+		case OP_BIT_AND:
+			height--;
+			stack[height - 1].llong &= stack[height].llong;
+			break;
+		case OP_BIT_XOR:
+			height--;
+			stack[height - 1].llong ^= stack[height].llong;
+			break;
+		case OP_BIT_NEG:
+			stack[height - 1].llong = ~stack[height - 1].llong;
+			break;
+		case OP_BIT_LSHIFT:
+			height--;
+			stack[height - 1].llong <<= stack[height].llong;
+			break;
+		case OP_BIT_RSHIFT:
+			height--;
+			stack[height - 1].llong >>= stack[height].llong;
+			break;
+		case OP_JUMP:
+			i += insn->skip;
+			break;
+		case OP_AND_JUMP:
+			if (stack[height - 1].llong == 0)
+				i += insn->skip;
+			break;
+		case OP_OR_JUMP:
+			if (stack[height - 1].llong == 1)
+				i += insn->skip;
+			break;
+		case OP_IF_JUMP:
+			height--;
+			if (stack[height].llong == 0)
+				i += insn->skip;
+			break;
+		case OP_LIKE:
+			stack[height - 1].llong =
+				like_match(insn->like, stack[height - 1].pchar);
+			stack[height - 1].type = RPN_LLONG;
+			break;
+		case OP_REGEX:
+			height -= oper_args[insn->regex.oper] - 1;
+			if (eval_regex(exp, insn->regex.oper, insn->regex.preg,
+					&stack[height - 1]))
+				return -1;
+			break;
+		default:
+			abort();
+		}
+	}
 
 	return 0;
 }
 
+#undef CMP_CASES
+#undef NUM_CASES
+
 int
-rpn_eval(const struct rpn_expression *exp,
-		const char *buf,
-		const size_t *col_offs,
+rpn_eval(struct rpn_expression *exp,
+		struct csv_values *row,
 		struct rpn_variant *value)
 {
-	struct rpn_variant *stack = NULL;
+	struct rpn_variant *stack = exp->stack;
 	size_t height = 0;
 
+	csv_arena_reset(&exp->scratch);
+
+	if (exp->code) {
+		if (run(exp, row))
+			return -1;
+
+		*value = stack[0];
+		return 0;
+	}
+
 	for (size_t j = 0; j < exp->count; ++j) {
 		const struct rpn_token *t = &exp->tokens[j];
 		if (t->type == RPN_CONSTANT) {
-			stack = xrealloc(stack, height + 1, sizeof(stack[0]));
-			if (!stack)
-				goto fail;
-
+			assert(height < exp->max_height);
 			stack[height++] = t->constant;
-			if (t->constant.type == RPN_PCHAR) {
-				stack[height - 1].pchar = xstrdup(stack[height - 1].pchar);
-				if (!stack[height - 1].pchar)
-					goto fail;
-			}
 		} else if (t->type == RPN_COLUMN) {
-			stack = xrealloc(stack, height + 1, sizeof(stack[0]));
-			if (!stack)
-				goto fail;
-
-			const char *str = &buf[col_offs[t->col.num]];
+			assert(height < exp->max_height);
+			size_t col = t->col.num;
 
 			if (strcmp(t->col.type, "int") == 0) {
 				stack[height].type = RPN_LLONG;
-				if (strtoll_safe(str, &stack[height].llong, 0))
-					goto fail;
+				if (csv_values_int(row, col,
+						&stack[height].llong))
+					return -1;
 			} else if (strcmp(t->col.type, "float") == 0) {
 				stack[height].type = RPN_DOUBLE;
-				if (strtod_safe(str, &stack[height].dbl))
-					goto fail;
+				if (csv_values_float(row, col,
+						&stack[height].dbl))
+					return -1;
 			} else if (strcmp(t->col.type, "string") == 0) {
 				stack[height].type = RPN_PCHAR;
-				if (str[0] == '"')
-					stack[height].pchar = csv_unquot(str);
-				else
-					stack[height].pchar = xstrdup(str);
-				if (!stack[height].pchar)
-					goto fail;
+				stack[height].pchar =
+					(char *)csv_values_str(row, col);
 			} else {
 				abort();
 			}
 			height++;
 		} else if (t->type == RPN_OPERATOR) {
-			if (eval_oper(t->operator, &stack, &height))
-				goto fail;
+			if (eval_oper(exp, t->operator, &height))
+				return -1;
 		} else {
 			/* impossible */
 			abort();
@@ -1292,23 +2199,17 @@ rpn_eval(const struct rpn_expression *exp,
 
 	if (height == 0) {
 		fprintf(stderr, "empty stack\n");
-		goto fail;
+		return -1;
 	}
 
 	if (height >= 2) {
 		fprintf(stderr, "too many entries on stack (%lu)\n", height);
-		goto fail;
+		return -1;
 	}
 
 	*value = stack[0];
 
-	free(stack);
-
 	return 0;
-
-fail:
-	free(stack);
-	return -1;
 }
 
 void
@@ -9,6 +9,7 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "regex_cache.h"
 #include "utils.h"
 
 struct str_tokens {
@@ -267,6 +268,8 @@ rpn_parse(struct rpn_expression *exp, char *str,
 		goto fail;
 	}
 
+	rpn_prepare(exp);
+
 	return 0;
 
 fail:
@@ -375,4 +378,17 @@ rpn_free(struct rpn_expression *exp)
 	}
 	free(exp->tokens);
 	exp->tokens = NULL;
+
+	free(exp->code);
+	exp->code = NULL;
+	csv_arena_fini(&exp->consts);
+	for (size_t i = 0; i < exp->nregexes; ++i)
+		csv_regex_free(&exp->regexes[i]);
+	free(exp->regexes);
+	exp->regexes = NULL;
+	free(exp->stack);
+	exp->stack = NULL;
+	csv_arena_fini(&exp->scratch);
+	free(exp->buf);
+	exp->buf = NULL;
 }
@@ -0,0 +1,258 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright 2021, Marcin Ślusarz <marcin.slusarz@gmail.com>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__SSE2__)
+#define CSV_SCAN_X86 1
+#include <immintrin.h>
+#endif
+#endif
+
+#include "scan.h"
+
+typedef size_t (*scan_fn)(const char *buf, size_t start, size_t end);
+typedef size_t (*scan_count_fn)(const char *buf, size_t start, size_t end,
+		size_t *ncommas);
+
+static size_t
+scan_unquoted_scalar(const char *buf, size_t i, size_t end)
+{
+	while (i < end && buf[i] != '"' && buf[i] != ',' && buf[i] != '\n')
+		i++;
+
+	return i;
+}
+
+static size_t
+scan_quoted_scalar(const char *buf, size_t i, size_t end)
+{
+	const char *quot = memchr(buf + i, '"', end - i);
+	if (!quot)
+		return end;
+
+	return (size_t)(quot - buf);
+}
+
+static size_t
+scan_row_tail_scalar(const char *buf, size_t i, size_t end, size_t *ncommas)
+{
+	size_t commas = 0;
+
+	while (i < end && buf[i] != '"' && buf[i] != '\n') {
+		if (buf[i] == ',')
+			commas++;
+		i++;
+	}
+
+	*ncommas += commas;
+	return i;
+}
+
+#ifdef CSV_SCAN_X86
+
+/*
+ * Each block of 16 (SSE2) or 32 (AVX2) bytes is compared against all special
+ * characters at once. Resulting bitmask has one bit per byte, so the position
+ * of the first special character is the number of trailing zeroes.
+ */
+
+static size_t
+scan_unquoted_sse2(const char *buf, size_t i, size_t end)
+{
+	const __m128i quot = _mm_set1_epi8('"');
+	const __m128i comma = _mm_set1_epi8(',');
+	const __m128i nl = _mm_set1_epi8('\n');
+
+	while (i + 16 <= end) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+		__m128i m = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, quot),
+					     _mm_cmpeq_epi8(v, comma)),
+				_mm_cmpeq_epi8(v, nl));
+		unsigned mask = (unsigned)_mm_movemask_epi8(m);
+		if (mask)
+			return i + (unsigned)__builtin_ctz(mask);
+		i += 16;
+	}
+
+	return scan_unquoted_scalar(buf, i, end);
+}
+
+static size_t
+scan_quoted_sse2(const char *buf, size_t i, size_t end)
+{
+	const __m128i quot = _mm_set1_epi8('"');
+
+	while (i + 16 <= end) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+		unsigned mask =
+			(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quot));
+		if (mask)
+			return i + (unsigned)__builtin_ctz(mask);
+		i += 16;
+	}
+
+	return scan_quoted_scalar(buf, i, end);
+}
+
+static size_t
+scan_row_tail_sse2(const char *buf, size_t i, size_t end, size_t *ncommas)
+{
+	const __m128i quot = _mm_set1_epi8('"');
+	const __m128i comma = _mm_set1_epi8(',');
+	const __m128i nl = _mm_set1_epi8('\n');
+
+	while (i + 16 <= end) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+		unsigned stop = (unsigned)_mm_movemask_epi8(
+				_mm_or_si128(_mm_cmpeq_epi8(v, quot),
+					     _mm_cmpeq_epi8(v, nl)));
+		unsigned commas = (unsigned)_mm_movemask_epi8(
+				_mm_cmpeq_epi8(v, comma));
+		if (stop) {
+			unsigned pos = (unsigned)__builtin_ctz(stop);
+			commas &= (1u << pos) - 1;
+			*ncommas += (size_t)__builtin_popcount(commas);
+			return i + pos;
+		}
+		*ncommas += (size_t)__builtin_popcount(commas);
+		i += 16;
+	}
+
+	return scan_row_tail_scalar(buf, i, end, ncommas);
+}
+
+__attribute__((target("avx2")))
+static size_t
+scan_unquoted_avx2(const char *buf, size_t i, size_t end)
+{
+	const __m256i quot = _mm256_set1_epi8('"');
+	const __m256i comma = _mm256_set1_epi8(',');
+	const __m256i nl = _mm256_set1_epi8('\n');
+
+	while (i + 32 <= end) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+		__m256i m = _mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, quot),
+						_mm256_cmpeq_epi8(v, comma)),
+				_mm256_cmpeq_epi8(v, nl));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+		if (mask)
+			return i + (unsigned)__builtin_ctz(mask);
+		i += 32;
+	}
+
+	return scan_unquoted_sse2(buf, i, end);
+}
+
+__attribute__((target("avx2")))
+static size_t
+scan_quoted_avx2(const char *buf, size_t i, size_t end)
+{
+	const __m256i quot = _mm256_set1_epi8('"');
+
+	while (i + 32 <= end) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(
+				_mm256_cmpeq_epi8(v, quot));
+		if (mask)
+			return i + (unsigned)__builtin_ctz(mask);
+		i += 32;
+	}
+
+	return scan_quoted_sse2(buf, i, end);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t
+scan_row_tail_avx2(const char *buf, size_t i, size_t end, size_t *ncommas)
+{
+	const __m256i quot = _mm256_set1_epi8('"');
+	const __m256i comma = _mm256_set1_epi8(',');
+	const __m256i nl = _mm256_set1_epi8('\n');
+
+	while (i + 32 <= end) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+		unsigned stop = (unsigned)_mm256_movemask_epi8(
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, quot),
+						_mm256_cmpeq_epi8(v, nl)));
+		unsigned commas = (unsigned)_mm256_movemask_epi8(
+				_mm256_cmpeq_epi8(v, comma));
+		if (stop) {
+			unsigned pos = (unsigned)__builtin_ctz(stop);
+			commas &= (1u << pos) - 1;
+			*ncommas += (size_t)__builtin_popcount(commas);
+			return i + pos;
+		}
+		*ncommas += (size_t)__builtin_popcount(commas);
+		i += 32;
+	}
+
+	return scan_row_tail_sse2(buf, i, end, ncommas);
+}
+
+#endif
+
+static scan_fn Scan_unquoted = scan_unquoted_scalar;
+static scan_fn Scan_quoted = scan_quoted_scalar;
+static scan_count_fn Scan_row_tail = scan_row_tail_scalar;
+
+/*
+ * Picks the best implementation supported by the CPU. CSVNIXTOOLS_SIMD
+ * environment variable ("none", "sse2", "avx2") can be used to limit it.
+ */
+void
+csv_scan_init(void)
+{
+	static bool initialized = false;
+	if (initialized)
+		return;
+	initialized = true;
+
+#ifdef CSV_SCAN_X86
+	const char *limit = getenv("CSVNIXTOOLS_SIMD");
+	if (limit && strcmp(limit, "none") == 0)
+		return;
+
+	Scan_unquoted = scan_unquoted_sse2;
+	Scan_quoted = scan_quoted_sse2;
+	Scan_row_tail = scan_row_tail_sse2;
+
+	if (limit && strcmp(limit, "sse2") == 0)
+		return;
+
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		Scan_unquoted = scan_unquoted_avx2;
+		Scan_quoted = scan_quoted_avx2;
+		Scan_row_tail = scan_row_tail_avx2;
+	}
+#endif
+}
+
+size_t
+csv_scan_unquoted(const char *buf, size_t start, size_t end)
+{
+	return Scan_unquoted(buf, start, end);
+}
+
+size_t
+csv_scan_quoted(const char *buf, size_t start, size_t end)
+{
+	return Scan_quoted(buf, start, end);
+}
+
+size_t
+csv_scan_row_tail(const char *buf, size_t start, size_t end, size_t *ncommas)
+{
+	*ncommas = 0;
+	return Scan_row_tail(buf, start, end, ncommas);
+}
@@ -0,0 +1,35 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Copyright 2021, Marcin Ślusarz <marcin.slusarz@gmail.com>
+ */
+
+#ifndef CSV_SCAN_H
+#define CSV_SCAN_H
+
+#include <stddef.h>
+
+void csv_scan_init(void);
+
+/*
+ * Returns index of the first character from buf[start, end) which has
+ * a special meaning outside of quoted string (", comma or new line),
+ * or end if there's no such character.
+ */
+size_t csv_scan_unquoted(const char *buf, size_t start, size_t end);
+
+/*
+ * Returns index of the first " from buf[start, end), or end if there's
+ * no such character.
+ */
+size_t csv_scan_quoted(const char *buf, size_t start, size_t end);
+
+/*
+ * Returns index of the first " or new line character from buf[start, end),
+ * or end if there's no such character. Number of commas before it is
+ * stored in *ncommas.
+ */
+size_t csv_scan_row_tail(const char *buf, size_t start, size_t end,
+		size_t *ncommas);
+
+#endif
@@ -7,16 +7,29 @@
 #include <errno.h>
 #include <getopt.h>
 #include <limits.h>
+#include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#ifdef C11THREADS_ENABLED
+#include <threads.h>
+#include "thread_utils.h"
+#endif
 
 #include "parse.h"
 #include "utils.h"
 
 static const struct option opts[] = {
+	{"batch-size",	required_argument,	NULL, 'M'},
+	{"buffer-size",	required_argument,	NULL, 'B'},
 	{"columns",	required_argument,	NULL, 'c'},
+	{"limit",	required_argument,	NULL, 'L'},
+	{"parallel",	required_argument,	NULL, 'P'},
 	{"reverse",	no_argument,		NULL, 'r'},
 	{"show",	no_argument,		NULL, 's'},
 	{"show-full",	no_argument,		NULL, 'S'},
@@ -38,7 +51,17 @@ usage(FILE *out)
 	fprintf(out,
 "  -c, --columns=NAME1[,NAME2...]\n"
 "                             sort first by column NAME1, then NAME2, etc.\n");
+	fprintf(out,
+"      --limit=N              print only the first N rows of sorted output\n");
+	fprintf(out,
+"      --parallel=N           use N threads for sorting\n");
 	fprintf(out, "  -r, --reverse              sort in descending order\n");
+	fprintf(out,
+"      --batch-size=NMERGE    merge at most NMERGE temporary files at once\n");
+	fprintf(out,
+"      --buffer-size=SIZE     use at most SIZE bytes (k, M or G suffixes are\n"
+"                             accepted) for buffered rows, sort bigger inputs\n"
+"                             using temporary files\n");
 	describe_Show(out);
 	describe_Show_full(out);
 	describe_Table(out);
@@ -46,52 +69,175 @@ usage(FILE *out)
 	describe_version(out);
 }
 
+enum key_type {
+	KEY_STR,
+	KEY_INT,
+	KEY_FLOAT,
+};
+
+struct sort_params {
+	size_t *columns;
+	/* types of columns */
+	enum key_type *types;
+	size_t ncolumns;
+
+	struct lines *lines;
+	/* false if rows have to be compared by cmp_lines */
+	bool use_keys;
+	size_t threads;
+};
+
 struct cb_params {
 	struct lines lines;
+	/* approximate memory used by buffered rows */
+	size_t buffered;
+	/* 0 means everything is sorted in memory */
+	size_t buffer_size;
+	/* NULL if all rows are printed */
+	struct top_rows *top;
+
+	size_t ncols;
+	bool reverse;
+	struct sort_params *sort_params;
 
 	size_t table_column;
 	char *table;
+
+	struct csv_writer out;
 };
 
-static int
-next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
-{
-	struct cb_params *params = arg;
+/*
+ * Sorted parts of the input (runs), stored in temporary files. Each row
+ * is stored as its length, column offsets and contents. Rows of a run
+ * are already in output order (descending for -r).
+ */
+struct runs {
+	char **paths;
+	size_t count;
+	size_t size;
+};
 
-	if (params->table) {
-		const char *table = &buf[col_offs[params->table_column]];
-		if (strcmp(table, params->table) != 0) {
-			csv_print_line(stdout, buf, col_offs, ncols, true);
+static struct runs Runs;
 
-			return 0;
+static void
+remove_runs(void)
+{
+	for (size_t i = 0; i < Runs.count; ++i) {
+		if (Runs.paths[i]) {
+			unlink(Runs.paths[i]);
+			free(Runs.paths[i]);
 		}
 	}
 
-	return lines_add(&params->lines, buf, col_offs, ncols);
+	free(Runs.paths);
+	Runs.paths = NULL;
+	Runs.count = 0;
+	Runs.size = 0;
 }
 
-struct sort_params {
-	const struct col_header *headers;
+static FILE *
+create_run(char **path)
+{
+	static bool cleanup_registered = false;
+	const char *dir = getenv("TMPDIR");
+	if (!dir || !dir[0])
+		dir = "/tmp";
 
-	size_t *columns;
-	size_t ncolumns;
+	if (csv_asprintf(path, "%s/csv-sort.XXXXXX", dir) == -1) {
+		perror("asprintf");
+		exit(2);
+	}
 
-	struct lines *lines;
-};
+	if (!cleanup_registered) {
+		atexit(remove_runs);
+		cleanup_registered = true;
+	}
 
-int
-cmp(const void *p1, const void *p2, void *arg)
+	int fd = mkstemp(*path);
+	if (fd < 0) {
+		fprintf(stderr, "can't create temporary file %s: %s\n", *path,
+				strerror(errno));
+		exit(2);
+	}
+
+	FILE *f = fdopen(fd, "w");
+	if (!f) {
+		perror("fdopen");
+		exit(2);
+	}
+
+	return f;
+}
+
+static void
+add_run(struct runs *runs, char *path)
+{
+	if (runs->count == runs->size) {
+		runs->size = runs->size ? runs->size * 2 : 16;
+		runs->paths = xrealloc_nofail(runs->paths, runs->size,
+				sizeof(runs->paths[0]));
+	}
+
+	runs->paths[runs->count++] = path;
+}
+
+static void
+close_run(FILE *f, const char *path)
+{
+	if (ferror(f) || fclose(f)) {
+		fprintf(stderr, "writing to %s failed: %s\n", path,
+				strerror(errno));
+		exit(2);
+	}
+}
+
+static void
+write_row(FILE *f, const struct line *line, size_t ncols)
 {
-	struct sort_params *params = arg;
-	size_t idx1 = *(const size_t *)p1;
-	size_t idx2 = *(const size_t *)p2;
-	const struct col_header *headers = params->headers;
-	struct line *lines = params->lines->data;
+	size_t len = csv_row_length(line->buf, line->col_offs, ncols) + 1;
 
+	if (fwrite(&len, sizeof(len), 1, f) != 1 ||
+			fwrite(line->col_offs, sizeof(line->col_offs[0]), ncols,
+					f) != ncols ||
+			fwrite(line->buf, 1, len, f) != len) {
+		perror("fwrite");
+		exit(2);
+	}
+}
+
+/* maps v to an unsigned value with the same order */
+static inline uint64_t
+int_key(long long v)
+{
+	return (uint64_t)v ^ (UINT64_C(1) << 63);
+}
+
+/*
+ * Maps d to an unsigned value with the same order. -0.0 is equal to 0.0
+ * and NaNs are bigger than everything else.
+ */
+static inline uint64_t
+float_key(double d)
+{
+	uint64_t u;
+
+	if (isnan(d))
+		return UINT64_MAX;
+	if (d == 0)
+		d = 0;
+
+	memcpy(&u, &d, sizeof(u));
+	if (u >> 63)
+		return ~u;
+	return u | (UINT64_C(1) << 63);
+}
+
+static int
+cmp_lines(const struct line *line1, const struct line *line2,
+		const struct sort_params *params)
+{
 	for (size_t i = 0; i < params->ncolumns; ++i) {
 		size_t col = params->columns[i];
-		const struct line *line1 = &lines[idx1];
-		const struct line *line2 = &lines[idx2];
 
 		const char *val1 = &line1->buf[line1->col_offs[col]];
 		const char *val2 = &line2->buf[line2->col_offs[col]];
@@ -100,52 +246,1011 @@ cmp(const void *p1, const void *p2, void *arg)
 		if (strcmp(val1, val2) == 0)
 			continue;
 
-		if (strcmp(headers[col].type, "int") == 0) {
-			long long llval1, llval2;
+		switch (params->types[i]) {
+			case KEY_INT: {
+				long long llval1, llval2;
 
-			if (strtoll_safe(val1, &llval1, 0))
-				exit(2);
+				if (strtoll_safe(val1, &llval1, 0))
+					exit(2);
 
-			if (strtoll_safe(val2, &llval2, 0))
-				exit(2);
+				if (strtoll_safe(val2, &llval2, 0))
+					exit(2);
 
-			if (llval1 < llval2)
-				return -1;
+				if (llval1 != llval2)
+					return llval1 < llval2 ? -1 : 1;
+				break;
+			}
+			case KEY_FLOAT: {
+				double dval1, dval2;
 
-			if (llval1 > llval2)
-				return 1;
+				if (strtod_safe(val1, &dval1))
+					exit(2);
 
-			return 0;
-		} else if (strcmp(headers[col].type, "float") == 0) {
-			double dval1, dval2;
+				if (strtod_safe(val2, &dval2))
+					exit(2);
+
+				uint64_t key1 = float_key(dval1);
+				uint64_t key2 = float_key(dval2);
+				if (key1 != key2)
+					return key1 < key2 ? -1 : 1;
+				break;
+			}
+			default:
+				return strcmp(val1, val2);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Normalized sort key of a row: values of all sort columns encoded in
+ * a way which makes the whole key comparable by memcmp - ints and floats
+ * as 8 big-endian bytes which compare like the numbers, strings with their
+ * terminating null byte. Because of the terminators no key is a prefix of
+ * another one. The first 8 bytes, as a number, are stored in prefix, which
+ * alone decides most comparisons.
+ */
+struct sort_key {
+	uint64_t prefix;
+	/* the whole key, NULL if it fits in prefix */
+	const unsigned char *key;
+	size_t len;
+	size_t idx;
+};
+
+static inline void
+store_be64(unsigned char *buf, uint64_t val)
+{
+	for (int i = 7; i >= 0; --i) {
+		buf[i] = val & 0xff;
+		val >>= 8;
+	}
+}
+
+/* returns the first 8 bytes of a key padded with zeroes, as a number */
+static inline uint64_t
+key_prefix(const unsigned char *key, size_t len)
+{
+	uint64_t val = 0;
+
+	for (size_t i = 0; i < 8; ++i)
+		val = (val << 8) | (i < len ? key[i] : 0);
+
+	return val;
+}
+
+static void
+fill_key(struct sort_key *key, const unsigned char *buf, size_t len,
+		struct csv_arena *arena)
+{
+	key->prefix = key_prefix(buf, len);
+	key->len = len;
+	key->key = NULL;
+
+	if (len > 8) {
+		unsigned char *copy = csv_arena_alloc(arena, len);
+		if (!copy) {
+			perror("malloc");
+			exit(2);
+		}
+		memcpy(copy, buf, len);
+		key->key = copy;
+	}
+}
+
+/*
+ * Computes keys of all buffered rows. Returns false if some numeric value
+ * couldn't be parsed - rows have to be compared by cmp_lines then, which
+ * reports the error if that value matters.
+ */
+static bool
+build_keys(struct sort_key *keys, const struct sort_params *params,
+		struct csv_arena *arena)
+{
+	const struct lines *lines = params->lines;
+	unsigned char *buf = NULL;
+	size_t size = 0;
+	bool valid = true;
+
+	for (size_t i = 0; i < lines->used; ++i) {
+		const struct line *line = &lines->data[i];
+		const size_t *offs = line->col_offs;
+		struct sort_key *key = &keys[i];
+
+		key->idx = i;
+
+		/* common case, key is the value itself */
+		if (params->ncolumns == 1 && params->types[0] == KEY_STR) {
+			const char *val = &line->buf[offs[params->columns[0]]];
+
+			key->key = (const unsigned char *)val;
+			key->len = strlen(val) + 1;
+			key->prefix = key_prefix(key->key, key->len);
+			continue;
+		}
+
+		size_t len = 0;
+
+		for (size_t j = 0; j < params->ncolumns; ++j) {
+			const char *val = &line->buf[offs[params->columns[j]]];
+			size_t vlen = params->types[j] == KEY_STR ?
+					strlen(val) + 1 : 8;
+
+			if (len + vlen > size) {
+				size = (len + vlen) * 2;
+				buf = xrealloc_nofail(buf, size, 1);
+			}
+
+			switch (params->types[j]) {
+				case KEY_INT: {
+					long long llval;
+					if (strtoll_safe2(val, &llval, 0,
+							false)) {
+						valid = false;
+						goto end;
+					}
+					store_be64(&buf[len], int_key(llval));
+					break;
+				}
+				case KEY_FLOAT: {
+					double dval;
+					if (strtod_safe2(val, &dval, false)) {
+						valid = false;
+						goto end;
+					}
+					store_be64(&buf[len], float_key(dval));
+					break;
+				}
+				default:
+					memcpy(&buf[len], val, vlen);
+					break;
+			}
+
+			len += vlen;
+		}
+
+		fill_key(key, buf, len, arena);
+	}
+
+end:
+	free(buf);
+
+	if (!valid) {
+		for (size_t i = 0; i < lines->used; ++i)
+			keys[i].idx = i;
+	}
+
+	return valid;
+}
+
+static int
+cmp_keys(const void *p1, const void *p2, void *arg)
+{
+	const struct sort_key *key1 = p1;
+	const struct sort_key *key2 = p2;
+	const struct sort_params *params = arg;
+
+	if (!params->use_keys) {
+		const struct line *lines = params->lines->data;
+		int ret = cmp_lines(&lines[key1->idx], &lines[key2->idx],
+				params);
+		if (ret)
+			return ret;
+	} else if (key1->prefix != key2->prefix) {
+		return key1->prefix < key2->prefix ? -1 : 1;
+	} else if (key1->len > 8 && key2->len > 8) {
+		/*
+		 * Equal prefixes and one short key would mean that it's
+		 * a prefix of the other key, so they would be equal.
+		 */
+		size_t len = key1->len < key2->len ? key1->len : key2->len;
+		int ret = memcmp(key1->key + 8, key2->key + 8, len - 8);
+		if (ret)
+			return ret;
+	}
+
+	/* keep equal rows in input order, whatever qsort does */
+	if (key1->idx < key2->idx)
+		return -1;
+	return key1->idx > key2->idx;
+}
+
+/*
+ * Radix sort is used when keys are fixed-width (only ints and floats) or fit
+ * in their prefixes, otherwise the number of passes would depend on the
+ * length of strings.
+ */
+static bool
+radix_sortable(const struct sort_key *keys, size_t n,
+		const struct sort_params *params)
+{
+	if (!params->use_keys)
+		return false;
+
+	bool numeric = true;
+	for (size_t i = 0; i < params->ncolumns; ++i)
+		if (params->types[i] == KEY_STR)
+			numeric = false;
+	if (numeric)
+		return true;
+
+	for (size_t i = 0; i < n; ++i)
+		if (keys[i].len > 8)
+			return false;
+
+	return true;
+}
+
+/*
+ * Stable LSD radix sort of keys by prefixes, one byte per pass. Passes over
+ * bytes which are the same in all keys are skipped. Returns keys or tmp,
+ * whichever holds the result.
+ */
+static struct sort_key *
+radix_sort_prefixes(struct sort_key *keys, struct sort_key *tmp, size_t n)
+{
+	size_t (*counts)[256] = xcalloc_nofail(8, sizeof(counts[0]));
+
+	for (size_t i = 0; i < n; ++i) {
+		uint64_t prefix = keys[i].prefix;
+
+		for (unsigned b = 0; b < 8; ++b)
+			counts[b][(prefix >> (8 * b)) & 0xff]++;
+	}
+
+	for (unsigned b = 0; b < 8; ++b) {
+		size_t *pos = counts[b];
+		unsigned shift = 8 * b;
+
+		if (pos[(keys[0].prefix >> shift) & 0xff] == n)
+			continue;
+
+		size_t sum = 0;
+		for (unsigned i = 0; i < 256; ++i) {
+			size_t count = pos[i];
+			pos[i] = sum;
+			sum += count;
+		}
 
-			if (strtod_safe(val1, &dval1))
-				exit(2);
+		for (size_t i = 0; i < n; ++i)
+			tmp[pos[(keys[i].prefix >> shift) & 0xff]++] = keys[i];
 
-			if (strtod_safe(val2, &dval2))
-				exit(2);
+		struct sort_key *swap = keys;
+		keys = tmp;
+		tmp = swap;
+	}
+
+	free(counts);
+
+	return keys;
+}
+
+/*
+ * Sorts keys by all their 8-byte words, starting from the last one, which
+ * is moved to prefix before its passes. Keys start in input order and each
+ * pass is stable, so the result is the same as of the comparison sort.
+ */
+static struct sort_key *
+radix_sort(struct sort_key *keys, size_t n, const struct sort_params *params)
+{
+	if (n < 2)
+		return keys;
+
+	struct sort_key *bufs[2] = { keys, xmalloc_nofail(n, sizeof(keys[0])) };
+	/* only keys of numeric columns can be longer than their prefixes */
+	size_t words = keys[0].len > 8 ? params->ncolumns : 1;
 
-			if (dval1 < dval2)
-				return -1;
+	for (size_t w = words; w > 0; --w) {
+		if (words > 1) {
+			for (size_t i = 0; i < n; ++i)
+				keys[i].prefix = key_prefix(
+						keys[i].key + 8 * (w - 1), 8);
+		}
 
-			if (dval1 > dval2)
-				return 1;
+		keys = radix_sort_prefixes(keys,
+				keys == bufs[0] ? bufs[1] : bufs[0], n);
+	}
+
+	free(keys == bufs[0] ? bufs[1] : bufs[0]);
+
+	return keys;
+}
+
+#ifdef C11THREADS_ENABLED
+
+/*
+ * Parallel sort: every thread sorts its own part of row keys, then
+ * sorted parts are merged in pairs until one is left. Each merge is split
+ * between threads by finding positions in both inputs (co-ranks) at which
+ * parts of the output start. Keys never compare equal (see cmp_keys), so
+ * the result is exactly the same as of the serial sort.
+ */
+
+struct sort_task {
+	struct sort_params *params;
+
+	/* sort: data[0, na) */
+	/* merge: a[0, na) and b[0, nb) into out[begin, end) */
+	struct sort_key *a;
+	size_t na;
+	struct sort_key *b;
+	size_t nb;
+	struct sort_key *out;
+	size_t begin;
+	size_t end;
+};
+
+struct sort_worker {
+	struct sort_task *tasks;
+	size_t ntasks;
+	size_t first;
+	size_t step;
+	bool merge;
+};
+
+static size_t
+co_rank(size_t k, const struct sort_key *a, size_t na,
+		const struct sort_key *b, size_t nb,
+		struct sort_params *params)
+{
+	size_t lo = k > nb ? k - nb : 0;
+	size_t hi = k < na ? k : na;
+
+	/* find the number of elements of a in the first k of the output */
+	while (lo < hi) {
+		size_t i = lo + (hi - lo) / 2;
+
+		if (cmp_keys(&a[i], &b[k - i - 1], params) < 0)
+			lo = i + 1;
+		else
+			hi = i;
+	}
+
+	return lo;
+}
+
+static void
+merge_part(struct sort_task *t)
+{
+	size_t i = co_rank(t->begin, t->a, t->na, t->b, t->nb, t->params);
+	size_t j = t->begin - i;
+	size_t i_end = co_rank(t->end, t->a, t->na, t->b, t->nb, t->params);
+	size_t j_end = t->end - i_end;
+	struct sort_key *out = t->out + t->begin;
+
+	while (i < i_end && j < j_end) {
+		if (cmp_keys(&t->a[i], &t->b[j], t->params) < 0)
+			*out++ = t->a[i++];
+		else
+			*out++ = t->b[j++];
+	}
+
+	memcpy(out, &t->a[i], (i_end - i) * sizeof(*out));
+	out += i_end - i;
+	memcpy(out, &t->b[j], (j_end - j) * sizeof(*out));
+}
+
+static int
+sort_worker(void *arg)
+{
+	struct sort_worker *w = arg;
+
+	for (size_t i = w->first; i < w->ntasks; i += w->step) {
+		struct sort_task *t = &w->tasks[i];
+
+		if (w->merge)
+			merge_part(t);
+		else
+			csv_qsort_r(t->a, t->na, sizeof(t->a[0]), cmp_keys,
+					t->params);
+	}
+
+	return 0;
+}
+
+static void
+run_tasks(struct sort_task *tasks, size_t ntasks, size_t nthreads,
+		bool merge)
+{
+	thrd_t *threads = xmalloc_nofail(nthreads, sizeof(threads[0]));
+	struct sort_worker *workers = xmalloc_nofail(nthreads,
+			sizeof(workers[0]));
+
+	for (size_t i = 0; i < nthreads; ++i) {
+		workers[i].tasks = tasks;
+		workers[i].ntasks = ntasks;
+		workers[i].first = i;
+		workers[i].step = nthreads;
+		workers[i].merge = merge;
+	}
+
+	for (size_t i = 1; i < nthreads; ++i)
+		thrd_create_nofail(&threads[i], sort_worker, &workers[i]);
+	sort_worker(&workers[0]);
+	for (size_t i = 1; i < nthreads; ++i)
+		thrd_join_nofail(threads[i], NULL);
+
+	free(workers);
+	free(threads);
+}
+
+static struct sort_key *
+sort_parallel(struct sort_key *keys, size_t n, struct sort_params *params)
+{
+	size_t nthreads = params->threads;
+	size_t nparts = nthreads;
+	/* boundaries of sorted parts */
+	size_t *parts = xmalloc_nofail(nparts + 1, sizeof(parts[0]));
+	struct sort_task *tasks = xmalloc_nofail(nthreads, sizeof(tasks[0]));
+
+	for (size_t i = 0; i <= nparts; ++i)
+		parts[i] = n / nparts * i + (i < n % nparts ? i : n % nparts);
+
+	for (size_t i = 0; i < nparts; ++i) {
+		tasks[i].params = params;
+		tasks[i].a = &keys[parts[i]];
+		tasks[i].na = parts[i + 1] - parts[i];
+	}
+	run_tasks(tasks, nparts, nthreads, false);
+
+	struct sort_key *tmp = xmalloc_nofail(n, sizeof(tmp[0]));
+
+	while (nparts > 1) {
+		size_t npairs = (nparts + 1) / 2;
+		size_t per_pair = (nthreads + npairs - 1) / npairs;
+		size_t ntasks = 0;
+
+		tasks = xrealloc_nofail(tasks, npairs * per_pair,
+				sizeof(tasks[0]));
+
+		for (size_t p = 0; p < npairs; ++p) {
+			size_t a = parts[2 * p];
+			size_t b = parts[2 * p + 1];
+			/* the last part may have no pair */
+			size_t end = 2 * p + 2 <= nparts ? parts[2 * p + 2] : b;
+			size_t len = end - a;
+
+			for (size_t k = 0; k < per_pair; ++k) {
+				struct sort_task *t = &tasks[ntasks++];
+
+				t->params = params;
+				t->a = &keys[a];
+				t->na = b - a;
+				t->b = &keys[b];
+				t->nb = end - b;
+				t->out = &tmp[a];
+				t->begin = len / per_pair * k;
+				t->end = k + 1 == per_pair ? len :
+						len / per_pair * (k + 1);
+			}
+
+			parts[p] = a;
+		}
+		parts[npairs] = n;
+		nparts = npairs;
+
+		run_tasks(tasks, ntasks, nthreads, true);
+
+		struct sort_key *swap = keys;
+		keys = tmp;
+		tmp = swap;
+	}
+
+	free(tmp);
+	free(tasks);
+	free(parts);
+
+	return keys;
+}
+
+#endif
+
+/*
+ * Returns keys of buffered rows in sorted order. Only their idx fields are
+ * meant to be used by callers.
+ */
+static struct sort_key *
+sort_lines(struct sort_params *params)
+{
+	struct lines *lines = params->lines;
+	struct sort_key *keys = xmalloc_nofail(lines->used, sizeof(keys[0]));
+	struct csv_arena arena;
+
+	csv_arena_init(&arena, 64 * 1024);
+	params->use_keys = build_keys(keys, params, &arena);
+
+	if (radix_sortable(keys, lines->used, params))
+		keys = radix_sort(keys, lines->used, params);
+#ifdef C11THREADS_ENABLED
+	/* not worth starting threads for small inputs */
+	else if (params->threads > 1 && lines->used >= 256 * params->threads)
+		keys = sort_parallel(keys, lines->used, params);
+#endif
+	else
+		csv_qsort_r(keys, lines->used, sizeof(keys[0]), cmp_keys,
+				params);
+
+	csv_arena_fini(&arena);
+
+	return keys;
+}
+
+static void
+print_line(struct csv_writer *out, const struct line *line, size_t ncols)
+{
+	csv_writer_raw_row(out, line->buf,
+			csv_row_length(line->buf, line->col_offs, ncols),
+			line->col_offs, ncols);
+}
+
+/*
+ * Rows kept by --limit, in a heap with the row which would be printed last
+ * at the top. A new row replaces it only if it would be printed earlier,
+ * so at most limit rows are ever buffered.
+ */
+struct top_row {
+	/* position in the input, orders equal rows */
+	size_t seq;
+	struct line line;
+};
+
+struct top_rows {
+	struct top_row **heap;
+	size_t count;
+	size_t size;
+	size_t limit;
+	size_t seq;
+
+	const struct sort_params *params;
+	bool reverse;
+};
+
+/* returns true if line1 is printed before line2 */
+static bool
+top_before(const struct line *line1, size_t seq1, const struct line *line2,
+		size_t seq2, const struct top_rows *top)
+{
+	int ret = cmp_lines(line1, line2, top->params);
+
+	if (ret == 0)
+		ret = seq1 < seq2 ? -1 : 1;
+	if (top->reverse)
+		ret = -ret;
+
+	return ret < 0;
+}
+
+static bool
+top_row_before(const struct top_row *r1, const struct top_row *r2,
+		const struct top_rows *top)
+{
+	return top_before(&r1->line, r1->seq, &r2->line, r2->seq, top);
+}
+
+static void
+top_sift_up(struct top_rows *top, size_t i)
+{
+	struct top_row **heap = top->heap;
+
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+
+		if (!top_row_before(heap[parent], heap[i], top))
+			return;
+
+		struct top_row *tmp = heap[i];
+		heap[i] = heap[parent];
+		heap[parent] = tmp;
+		i = parent;
+	}
+}
+
+static void
+top_sift_down(struct top_rows *top, size_t i)
+{
+	struct top_row **heap = top->heap;
+	size_t n = top->count;
+
+	while (true) {
+		size_t last = i;
+		size_t l = 2 * i + 1;
+		size_t r = l + 1;
+
+		if (l < n && top_row_before(heap[last], heap[l], top))
+			last = l;
+		if (r < n && top_row_before(heap[last], heap[r], top))
+			last = r;
+		if (last == i)
+			return;
+
+		struct top_row *tmp = heap[i];
+		heap[i] = heap[last];
+		heap[last] = tmp;
+		i = last;
+	}
+}
+
+static struct top_row *
+top_row_new(const char *buf, const size_t *col_offs, size_t ncols,
+		size_t seq)
+{
+	size_t len = csv_row_length(buf, col_offs, ncols) + 1;
+	struct top_row *row = xmalloc_nofail(1, sizeof(*row) +
+			ncols * sizeof(col_offs[0]) + len);
+
+	row->seq = seq;
+	row->line.col_offs = (size_t *)(row + 1);
+	row->line.buf = (char *)(row->line.col_offs + ncols);
+	row->line.user = NULL;
+
+	memcpy(row->line.col_offs, col_offs, ncols * sizeof(col_offs[0]));
+	memcpy(row->line.buf, buf, len);
+
+	return row;
+}
+
+static void
+top_add(struct top_rows *top, const char *buf, const size_t *col_offs,
+		size_t ncols)
+{
+	size_t seq = top->seq++;
+
+	if (top->limit == 0)
+		return;
+
+	if (top->count == top->limit) {
+		struct line line;
+
+		line.buf = (char *)buf;
+		line.col_offs = (size_t *)col_offs;
+		line.user = NULL;
+
+		/* drop rows which won't be printed, without copying them */
+		if (!top_before(&line, seq, &top->heap[0]->line,
+				top->heap[0]->seq, top))
+			return;
+
+		free(top->heap[0]);
+		top->heap[0] = top_row_new(buf, col_offs, ncols, seq);
+		top_sift_down(top, 0);
+
+		return;
+	}
+
+	if (top->count == top->size) {
+		top->size = top->size ? top->size * 2 : 64;
+		if (top->size > top->limit)
+			top->size = top->limit;
+		top->heap = xrealloc_nofail(top->heap, top->size,
+				sizeof(top->heap[0]));
+	}
+
+	top->heap[top->count] = top_row_new(buf, col_offs, ncols, seq);
+	top_sift_up(top, top->count++);
+}
+
+static int
+top_cmp(const void *p1, const void *p2, void *arg)
+{
+	const struct top_row *r1 = *(const struct top_row **)p1;
+	const struct top_row *r2 = *(const struct top_row **)p2;
+
+	if (r1 == r2)
+		return 0;
+	return top_row_before(r1, r2, arg) ? -1 : 1;
+}
+
+static void
+top_print(struct top_rows *top, struct csv_writer *out, size_t ncols)
+{
+	if (top->count > 1)
+		csv_qsort_r(top->heap, top->count, sizeof(top->heap[0]),
+				top_cmp, top);
+
+	for (size_t i = 0; i < top->count; ++i) {
+		print_line(out, &top->heap[i]->line, ncols);
+		free(top->heap[i]);
+	}
+
+	free(top->heap);
+	top->heap = NULL;
+	top->count = 0;
+	top->size = 0;
+}
+
+/* sorts buffered rows and moves them to a new run */
+static void
+spill_run(struct cb_params *params)
+{
+	struct lines *lines = &params->lines;
+	struct sort_key *keys = sort_lines(params->sort_params);
+	char *path;
+	FILE *f = create_run(&path);
+
+	/* ownership of path goes to Runs, so it's removed on exit */
+	add_run(&Runs, path);
+
+	for (size_t i = 0; i < lines->used; ++i) {
+		size_t idx = params->reverse ? keys[lines->used - 1 - i].idx :
+				keys[i].idx;
+		write_row(f, &lines->data[idx], params->ncols);
+	}
+
+	close_run(f, path);
+	free(keys);
+
+	lines_fini(lines);
+	params->buffered = 0;
+}
+
+static int
+next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
+{
+	struct cb_params *params = arg;
+
+	if (params->table) {
+		const char *table = &buf[col_offs[params->table_column]];
+		if (strcmp(table, params->table) != 0) {
+			csv_writer_raw_row(&params->out, buf,
+					csv_row_length(buf, col_offs, ncols),
+					col_offs, ncols);
 
 			return 0;
-		} else {
-			return strcmp(val1, val2);
 		}
 	}
 
+	if (params->top) {
+		top_add(params->top, buf, col_offs, ncols);
+		return 0;
+	}
+
+	if (lines_add(&params->lines, buf, col_offs, ncols))
+		return -1;
+
+	if (params->buffer_size) {
+		params->buffered += sizeof(struct line) +
+				sizeof(struct sort_key) +
+				ncols * sizeof(col_offs[0]) +
+				csv_row_length(buf, col_offs, ncols) + 1;
+
+		if (params->buffered > params->buffer_size)
+			spill_run(params);
+	}
+
 	return 0;
 }
 
+struct run_reader {
+	FILE *f;
+	/* position of the run, used to keep equal rows in input order */
+	size_t idx;
+
+	struct line line;
+	char *buf;
+	size_t buf_size;
+};
+
+/* returns false at the end of the run */
+static bool
+read_row(struct run_reader *r, size_t ncols, const char *path)
+{
+	size_t len;
+	if (fread(&len, sizeof(len), 1, r->f) != 1) {
+		if (ferror(r->f)) {
+			fprintf(stderr, "reading from %s failed: %s\n", path,
+					strerror(errno));
+			exit(2);
+		}
+		return false;
+	}
+
+	size_t offs_size = ncols * sizeof(r->line.col_offs[0]);
+	if (offs_size + len > r->buf_size) {
+		free(r->buf);
+		r->buf_size = offs_size + len;
+		r->buf = xmalloc_nofail(r->buf_size, 1);
+	}
+
+	if (fread(r->buf, 1, offs_size + len, r->f) != offs_size + len) {
+		fprintf(stderr, "%s is truncated\n", path);
+		exit(2);
+	}
+
+	r->line.col_offs = (size_t *)r->buf;
+	r->line.buf = r->buf + offs_size;
+
+	return true;
+}
+
+struct merge_params {
+	const struct sort_params *sort_params;
+	bool reverse;
+	size_t ncols;
+};
+
+static bool
+reader_before(const struct run_reader *r1, const struct run_reader *r2,
+		const struct merge_params *params)
+{
+	int ret = cmp_lines(&r1->line, &r2->line, params->sort_params);
+
+	if (params->reverse)
+		ret = -ret;
+
+	if (ret)
+		return ret < 0;
+
+	/* runs are reversed as a whole for -r */
+	if (params->reverse)
+		return r1->idx > r2->idx;
+	return r1->idx < r2->idx;
+}
+
 static void
-print_line(struct line *line, size_t ncols)
+sift_down(struct run_reader **heap, size_t n, size_t i,
+		const struct merge_params *params)
 {
-	csv_print_line(stdout, line->buf, line->col_offs, ncols, true);
+	while (true) {
+		size_t min = i;
+		size_t l = 2 * i + 1;
+		size_t r = l + 1;
 
-	lines_free_one(line);
+		if (l < n && reader_before(heap[l], heap[min], params))
+			min = l;
+		if (r < n && reader_before(heap[r], heap[min], params))
+			min = r;
+		if (min == i)
+			return;
+
+		struct run_reader *tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+/*
+ * Merges runs[first, first + count) into f or, if f is NULL, into the
+ * output. Merged runs are removed.
+ */
+static void
+merge_runs(struct runs *runs, size_t first, size_t count, FILE *f,
+		struct csv_writer *out, const struct merge_params *params)
+{
+	struct run_reader *readers = xcalloc_nofail(count, sizeof(readers[0]));
+	struct run_reader **heap = xmalloc_nofail(count, sizeof(heap[0]));
+	size_t n = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		struct run_reader *r = &readers[i];
+		const char *path = runs->paths[first + i];
+
+		r->f = fopen(path, "r");
+		if (!r->f) {
+			fprintf(stderr, "can't open %s: %s\n", path,
+					strerror(errno));
+			exit(2);
+		}
+		r->idx = i;
+
+		if (read_row(r, params->ncols, path))
+			heap[n++] = r;
+	}
+
+	for (size_t i = n / 2; i > 0; --i)
+		sift_down(heap, n, i - 1, params);
+
+	while (n > 0) {
+		struct run_reader *r = heap[0];
+
+		if (f)
+			write_row(f, &r->line, params->ncols);
+		else
+			print_line(out, &r->line, params->ncols);
+
+		if (!read_row(r, params->ncols, runs->paths[first + r->idx]))
+			heap[0] = heap[--n];
+		sift_down(heap, n, 0, params);
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		char **path = &runs->paths[first + i];
+
+		fclose(readers[i].f);
+		free(readers[i].buf);
+		unlink(*path);
+		free(*path);
+		*path = NULL;
+	}
+
+	free(heap);
+	free(readers);
+}
+
+/*
+ * Merges all runs into the output. If there are more runs than can be open
+ * at the same time, groups of neighbouring runs are merged into bigger
+ * runs first.
+ */
+static void
+merge_all(size_t batch, struct csv_writer *out,
+		const struct merge_params *params)
+{
+	while (Runs.count > batch) {
+		struct runs merged = { NULL, 0, 0 };
+
+		for (size_t i = 0; i < Runs.count; i += batch) {
+			size_t count = Runs.count - i;
+			if (count > batch)
+				count = batch;
+
+			if (count == 1) {
+				add_run(&merged, Runs.paths[i]);
+				Runs.paths[i] = NULL;
+				continue;
+			}
+
+			char *path;
+			FILE *f = create_run(&path);
+			add_run(&merged, path);
+			merge_runs(&Runs, i, count, f, NULL, params);
+			close_run(f, path);
+		}
+
+		free(Runs.paths);
+		Runs = merged;
+	}
+
+	merge_runs(&Runs, 0, Runs.count, NULL, out, params);
+	remove_runs();
+}
+
+/* default number of runs merged at once, limited by open files */
+static size_t
+default_batch_size(void)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) || rl.rlim_cur == RLIM_INFINITY ||
+			rl.rlim_cur > 4096)
+		return 4096;
+
+	/* standard streams, output run and some spare ones */
+	if (rl.rlim_cur < 16)
+		return 2;
+
+	return rl.rlim_cur - 8;
+}
+
+static size_t
+parse_size(const char *str)
+{
+	char *end;
+	errno = 0;
+	unsigned long long size = strtoull(str, &end, 10);
+	if (errno || end == str || str[0] == '-')
+		goto invalid;
+
+	unsigned long long mul = 1;
+	if (*end == 'k' || *end == 'K')
+		mul = 1024;
+	else if (*end == 'm' || *end == 'M')
+		mul = 1024 * 1024;
+	else if (*end == 'g' || *end == 'G')
+		mul = 1024 * 1024 * 1024;
+
+	if (mul != 1)
+		end++;
+
+	if (*end || size == 0 || size > SIZE_MAX / mul)
+		goto invalid;
+
+	return (size_t)(size * mul);
+
+invalid:
+	fprintf(stderr, "invalid size '%s'\n", str);
+	exit(2);
 }
 
 int
@@ -157,18 +1262,62 @@ main(int argc, char *argv[])
 	char *cols = NULL;
 	struct sort_params sort_params;
 	unsigned show_flags = SHOW_DISABLED;
+	size_t batch = 0;
+	struct top_rows top;
 
 	sort_params.columns = NULL;
+	sort_params.types = NULL;
 	sort_params.ncolumns = 0;
+	sort_params.threads = 1;
 	params.table = NULL;
 	params.table_column = SIZE_MAX;
+	params.buffered = 0;
+	params.buffer_size = 0;
+	params.top = NULL;
 	lines_init(&params.lines);
 
 	while ((opt = getopt_long(argc, argv, "c:rsST:", opts, NULL)) != -1) {
 		switch (opt) {
+			case 'B':
+				params.buffer_size = parse_size(optarg);
+				break;
+			case 'M': {
+				unsigned long long val;
+				if (strtoull_safe(optarg, &val, 0))
+					exit(2);
+				if (val < 2) {
+					fprintf(stderr,
+						"batch size must be at least 2\n");
+					exit(2);
+				}
+				batch = val > SIZE_MAX ? SIZE_MAX : (size_t)val;
+				break;
+			}
 			case 'c':
 				cols = xstrdup_nofail(optarg);
 				break;
+			case 'L': {
+				unsigned long long val;
+				if (strtoull_safe(optarg, &val, 0))
+					exit(2);
+				memset(&top, 0, sizeof(top));
+				top.limit = val > SIZE_MAX ? SIZE_MAX :
+						(size_t)val;
+				params.top = &top;
+				break;
+			}
+			case 'P': {
+				unsigned long long val;
+				if (strtoull_safe(optarg, &val, 0))
+					exit(2);
+				if (val == 0 || val > 1024) {
+					fprintf(stderr,
+						"number of threads must be between 1 and 1024\n");
+					exit(2);
+				}
+				sort_params.threads = (size_t)val;
+				break;
+			}
 			case 'r':
 				reverse = true;
 				break;
@@ -207,6 +1356,7 @@ main(int argc, char *argv[])
 	size_t nheaders = csv_get_headers(s, &headers);
 
 	sort_params.columns = xmalloc_nofail(nheaders, sizeof(sort_params.columns[0]));
+	sort_params.types = xmalloc_nofail(nheaders, sizeof(sort_params.types[0]));
 
 	if (params.table) {
 		params.table_column = csv_find(headers, nheaders, TABLE_COLUMN);
@@ -233,6 +1383,13 @@ main(int argc, char *argv[])
 			exit(2);
 		}
 
+		enum key_type type = KEY_STR;
+		if (strcmp(headers[idx].type, "int") == 0)
+			type = KEY_INT;
+		else if (strcmp(headers[idx].type, "float") == 0)
+			type = KEY_FLOAT;
+
+		sort_params.types[sort_params.ncolumns] = type;
 		sort_params.columns[sort_params.ncolumns++] = idx;
 	}
 	free(cols);
@@ -240,31 +1397,54 @@ main(int argc, char *argv[])
 
 	csv_print_headers(stdout, headers, nheaders);
 
+	sort_params.lines = &params.lines;
+	params.ncols = nheaders;
+	params.reverse = reverse;
+	params.sort_params = &sort_params;
+	if (params.top) {
+		top.params = &sort_params;
+		top.reverse = reverse;
+	}
+
+	csv_writer_init(&params.out, stdout, CSV_WRITER_DEFAULT_SIZE);
 	csv_read_all_nofail(s, &next_row, &params);
 
-	struct lines *lines = &params.lines;
-	size_t *row_idx = xmalloc_nofail(lines->used, sizeof(row_idx[0]));
+	if (params.top) {
+		top_print(params.top, &params.out, nheaders);
+	} else if (Runs.count > 0) {
+		struct merge_params merge_params;
 
-	for (size_t i = 0; i < lines->used; ++i)
-		row_idx[i] = i;
+		if (params.lines.used > 0)
+			spill_run(&params);
 
-	sort_params.headers = headers;
-	sort_params.lines = &params.lines;
-	csv_qsort_r(row_idx, lines->used, sizeof(row_idx[0]), cmp, &sort_params);
-
-	struct line *line = params.lines.data;
-	if (reverse) {
-		for (size_t i = lines->used; i > 0; --i)
-			print_line(&line[row_idx[i - 1]], nheaders);
+		merge_params.sort_params = &sort_params;
+		merge_params.reverse = reverse;
+		merge_params.ncols = nheaders;
+		merge_all(batch ? batch : default_batch_size(), &params.out,
+				&merge_params);
 	} else {
-		for (size_t i = 0; i < lines->used; ++i)
-			print_line(&line[row_idx[i]], nheaders);
+		struct lines *lines = &params.lines;
+		struct sort_key *keys = sort_lines(&sort_params);
+
+		struct line *line = params.lines.data;
+		if (reverse) {
+			for (size_t i = lines->used; i > 0; --i)
+				print_line(&params.out, &line[keys[i - 1].idx],
+						nheaders);
+		} else {
+			for (size_t i = 0; i < lines->used; ++i)
+				print_line(&params.out, &line[keys[i].idx],
+						nheaders);
+		}
+
+		free(keys);
 	}
+	csv_writer_fini(&params.out);
 
-	free(row_idx);
 	lines_fini(&params.lines);
 	free(params.table);
 	free(sort_params.columns);
+	free(sort_params.types);
 
 	csv_destroy_ctx(s);
 
@@ -50,31 +50,252 @@ struct order_conditions {
 	size_t count;
 };
 
+/*
+ * Rows kept by ORDER BY ... LIMIT, in a heap with the row which would be
+ * printed last at the top. A new row replaces it only if it would be
+ * printed earlier, so at most limit rows are ever buffered.
+ */
+struct top_row {
+	/* position in the input, orders equal rows */
+	size_t seq;
+	/* values of order by expressions */
+	struct rpn_variant *order;
+	char *buf;
+	size_t col_offs[];
+};
+
+struct top_rows {
+	struct top_row **heap;
+	size_t count;
+	size_t size;
+	size_t seq;
+
+	/* values of order by expressions of the current row */
+	struct rpn_variant *order;
+};
+
 struct cb_params {
 	struct columns columns;
 	struct rpn_expression where;
 	struct order_conditions order_by;
 
+	bool has_limit;
+	size_t limit;
+	/* number of printed rows, used only without order by */
+	size_t printed;
+	struct top_rows top;
+
 	struct lines lines;
+
+	struct csv_values row;
 };
 
+static int
+cmp_order(const struct rpn_variant *order1, const struct rpn_variant *order2,
+		const struct order_conditions *order_by)
+{
+	for (size_t i = 0; i < order_by->count; ++i) {
+		bool asc = order_by->cond[i].asc;
+
+		const struct rpn_variant *v1 = &order1[i];
+		const struct rpn_variant *v2 = &order2[i];
+
+		assert(v1->type == v2->type);
+		bool less;
+		if (v1->type == RPN_LLONG) {
+			if (v1->llong == v2->llong)
+				continue;
+			less = v1->llong < v2->llong;
+		} else if (v1->type == RPN_PCHAR) {
+			int c = strcmp(v1->pchar, v2->pchar);
+			if (c == 0)
+				continue;
+			less = c < 0;
+		} else if (v1->type == RPN_DOUBLE) {
+			if (v1->dbl == v2->dbl)
+				continue;
+			less = v1->dbl < v2->dbl;
+		} else {
+			assert(!"unhandled type");
+			abort();
+		}
+
+		if (less == asc)
+			return -1;
+		else
+			return 1;
+	}
+
+	return 0;
+}
+
+/* returns true if row with order1 is printed before row with order2 */
+static bool
+top_before(const struct rpn_variant *order1, size_t seq1,
+		const struct rpn_variant *order2, size_t seq2,
+		const struct order_conditions *order_by)
+{
+	int ret = cmp_order(order1, order2, order_by);
+
+	if (ret)
+		return ret < 0;
+	return seq1 < seq2;
+}
+
+static bool
+top_row_before(const struct top_row *r1, const struct top_row *r2,
+		const struct order_conditions *order_by)
+{
+	return top_before(r1->order, r1->seq, r2->order, r2->seq, order_by);
+}
+
+static void
+top_sift_up(struct top_rows *top, size_t i,
+		const struct order_conditions *order_by)
+{
+	struct top_row **heap = top->heap;
+
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+
+		if (!top_row_before(heap[parent], heap[i], order_by))
+			return;
+
+		struct top_row *tmp = heap[i];
+		heap[i] = heap[parent];
+		heap[parent] = tmp;
+		i = parent;
+	}
+}
+
+static void
+top_sift_down(struct top_rows *top, size_t i,
+		const struct order_conditions *order_by)
+{
+	struct top_row **heap = top->heap;
+	size_t n = top->count;
+
+	while (true) {
+		size_t last = i;
+		size_t l = 2 * i + 1;
+		size_t r = l + 1;
+
+		if (l < n && top_row_before(heap[last], heap[l], order_by))
+			last = l;
+		if (r < n && top_row_before(heap[last], heap[r], order_by))
+			last = r;
+		if (last == i)
+			return;
+
+		struct top_row *tmp = heap[i];
+		heap[i] = heap[last];
+		heap[last] = tmp;
+		i = last;
+	}
+}
+
+static struct top_row *
+top_row_new(const char *buf, const size_t *col_offs, size_t ncols,
+		size_t seq, const struct rpn_variant *order, size_t norder)
+{
+	size_t len = csv_row_length(buf, col_offs, ncols) + 1;
+	struct top_row *row = xmalloc_nofail(1, sizeof(*row) +
+			ncols * sizeof(col_offs[0]) + len);
+
+	row->seq = seq;
+	row->buf = (char *)&row->col_offs[ncols];
+	memcpy(row->col_offs, col_offs, ncols * sizeof(col_offs[0]));
+	memcpy(row->buf, buf, len);
+
+	row->order = xmalloc_nofail(norder, sizeof(row->order[0]));
+	for (size_t i = 0; i < norder; ++i) {
+		row->order[i] = order[i];
+
+		/* the row is gone when sorting happens */
+		if (order[i].type == RPN_PCHAR)
+			row->order[i].pchar = xstrdup_nofail(order[i].pchar);
+	}
+
+	return row;
+}
+
 static void
-process_exp(const struct rpn_expression *exp, const char *buf,
-		const size_t *col_offs, char sep)
+top_row_free(struct top_row *row, size_t norder)
+{
+	for (size_t i = 0; i < norder; ++i)
+		if (row->order[i].type == RPN_PCHAR)
+			free(row->order[i].pchar);
+	free(row->order);
+	free(row);
+}
+
+static void
+top_add(struct cb_params *params, const char *buf, const size_t *col_offs,
+		size_t ncols)
+{
+	struct top_rows *top = &params->top;
+	const struct order_conditions *order_by = &params->order_by;
+	size_t seq = top->seq++;
+
+	if (params->limit == 0)
+		return;
+
+	if (!top->order)
+		top->order = xmalloc_nofail(order_by->count,
+				sizeof(top->order[0]));
+
+	for (size_t i = 0; i < order_by->count; ++i) {
+		if (rpn_eval(&order_by->cond[i].expr, &params->row,
+				&top->order[i]))
+			exit(2);
+	}
+
+	if (top->count == params->limit) {
+		struct top_row *last = top->heap[0];
+
+		/* drop rows which won't be printed, without copying them */
+		if (!top_before(top->order, seq, last->order, last->seq,
+				order_by))
+			return;
+
+		top_row_free(last, order_by->count);
+		top->heap[0] = top_row_new(buf, col_offs, ncols, seq,
+				top->order, order_by->count);
+		top_sift_down(top, 0, order_by);
+
+		return;
+	}
+
+	if (top->count == top->size) {
+		top->size = top->size ? top->size * 2 : 64;
+		if (top->size > params->limit)
+			top->size = params->limit;
+		top->heap = xrealloc_nofail(top->heap, top->size,
+				sizeof(top->heap[0]));
+	}
+
+	top->heap[top->count] = top_row_new(buf, col_offs, ncols, seq,
+			top->order, order_by->count);
+	top_sift_up(top, top->count++, order_by);
+}
+
+static void
+process_exp(struct rpn_expression *exp, struct csv_values *row, char sep)
 {
 	struct rpn_variant ret;
 
-	if (rpn_eval(exp, buf, col_offs, &ret))
+	if (rpn_eval(exp, row, &ret))
 		exit(2);
 
 	if (ret.type == RPN_LLONG) {
-		printf("%lld%c", ret.llong, sep);
+		csv_print_int(stdout, ret.llong);
+		fputc(sep, stdout);
 	} else if (ret.type == RPN_PCHAR) {
 		csv_print_quoted(ret.pchar, strlen(ret.pchar));
 		fputc(sep, stdout);
-		free(ret.pchar);
 	} else if (ret.type == RPN_DOUBLE) {
-		printf("%f%c", ret.dbl, sep);
+		csv_print_double(stdout, ret.dbl);
+		fputc(sep, stdout);
 	} else {
 		fprintf(stderr, "unknown type %d\n", ret.type);
 		exit(2);
@@ -82,18 +303,18 @@ process_exp(const struct rpn_expression *exp, const char *buf,
 }
 
 static void
-print_row(const struct columns *columns, const char *buf, const size_t *col_offs)
+print_row(struct columns *columns, struct csv_values *row)
 {
-	const struct rpn_expression *exp;
+	struct rpn_expression *exp;
 	for (size_t i = 0; i < columns->count - 1; ++i) {
 		exp = &columns->col[i].expr;
 
-		process_exp(exp, buf, col_offs, ',');
+		process_exp(exp, row, ',');
 	}
 
 	exp = &columns->col[columns->count - 1].expr;
 
-	process_exp(exp, buf, col_offs, '\n');
+	process_exp(exp, row, '\n');
 }
 
 static int
@@ -102,8 +323,10 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 	struct cb_params *params = arg;
 	struct rpn_variant ret;
 
+	csv_values_set_row(&params->row, buf, col_offs);
+
 	if (params->where.count) {
-		if (rpn_eval(&params->where, buf, col_offs, &ret))
+		if (rpn_eval(&params->where, &params->row, &ret))
 			exit(2);
 
 		if (ret.type != RPN_LLONG) /* shouldn't be possible - XXX? */
@@ -113,6 +336,11 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 			return 0;
 	}
 
+	if (params->order_by.count && params->has_limit) {
+		top_add(params, buf, col_offs, ncols);
+		return 0;
+	}
+
 	if (params->order_by.count) {
 		struct lines *lines = &params->lines;
 		int ret = lines_add(lines, buf, col_offs, ncols);
@@ -123,22 +351,31 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 		struct rpn_variant *order = line->user =
 			xmalloc(params->order_by.count, sizeof(struct rpn_variant));
 		if (!order) {
-			lines_free_one(line);
 			lines->used--;
 			return -1;
 		}
 
-		const struct rpn_expression *exp;
+		struct rpn_expression *exp;
 		for (size_t i = 0; i < params->order_by.count; ++i) {
 			exp = &params->order_by.cond[i].expr;
-			if (rpn_eval(exp, buf, col_offs, &order[i]))
+			if (rpn_eval(exp, &params->row, &order[i]))
 				exit(2);
+
+			/* the row is gone when sorting happens */
+			if (order[i].type == RPN_PCHAR)
+				order[i].pchar = xstrdup_nofail(order[i].pchar);
 		}
 
 		return 0;
 	}
 
-	print_row(&params->columns, buf, col_offs);
+	if (params->has_limit) {
+		if (params->printed == params->limit)
+			return 0;
+		params->printed++;
+	}
+
+	print_row(&params->columns, &params->row);
 
 	return 0;
 }
@@ -151,6 +388,7 @@ sql_column_done(void)
 	struct rpn_expression exp;
 	exp.tokens = Tokens;
 	exp.count = Ntokens;
+	rpn_prepare(&exp);
 
 	struct columns *columns = &Params.columns;
 	columns->col = xrealloc_nofail(columns->col,
@@ -175,6 +413,7 @@ sql_named_column_done(char *name)
 	struct rpn_expression exp;
 	exp.tokens = Tokens;
 	exp.count = Ntokens;
+	rpn_prepare(&exp);
 
 	struct columns *columns = &Params.columns;
 	columns->col = xrealloc_nofail(columns->col,
@@ -205,6 +444,7 @@ sql_all_columns(void)
 		col->expr.tokens[0].type = RPN_COLUMN;
 		col->expr.tokens[0].col.num = i;
 		col->expr.tokens[0].col.type = Headers[i].type;
+		rpn_prepare(&col->expr);
 	}
 }
 
@@ -233,6 +473,7 @@ sql_end_of_conditions()
 {
 	Params.where.tokens = Tokens;
 	Params.where.count = Ntokens;
+	rpn_prepare(&Params.where);
 
 	Tokens = NULL;
 	Ntokens = 0;
@@ -253,6 +494,7 @@ sql_order_by_expr_done(bool asc)
 	struct rpn_expression exp;
 	exp.tokens = Tokens;
 	exp.count = Ntokens;
+	rpn_prepare(&exp);
 
 	struct order_conditions *conds = &Params.order_by;
 	conds->cond = xrealloc_nofail(conds->cond,
@@ -268,6 +510,13 @@ sql_order_by_expr_done(bool asc)
 	Ntokens = 0;
 }
 
+void
+sql_limit(long long limit)
+{
+	Params.has_limit = true;
+	Params.limit = (size_t)limit;
+}
+
 static void
 print_column_header(size_t i, char sep, bool any_str_column_had_type)
 {
@@ -300,41 +549,44 @@ cmp(const void *p1, const void *p2, void *arg)
 	const struct line *line1 = &params->lines->data[idx1];
 	const struct line *line2 = &params->lines->data[idx2];
 
-	for (size_t i = 0; i < params->order_by->count; ++i) {
-		bool asc = params->order_by->cond[i].asc;
-		const struct rpn_variant *order1 = line1->user;
-		const struct rpn_variant *order2 = line2->user;
+	int ret = cmp_order(line1->user, line2->user, params->order_by);
+	if (ret)
+		return ret;
 
-		const struct rpn_variant *v1 = &order1[i];
-		const struct rpn_variant *v2 = &order2[i];
+	/* keep equal rows in input order, whatever qsort does */
+	if (idx1 < idx2)
+		return -1;
+	return idx1 > idx2;
+}
 
-		assert(v1->type == v2->type);
-		bool less;
-		if (v1->type == RPN_LLONG) {
-			if (v1->llong == v2->llong)
-				continue;
-			less = v1->llong < v2->llong;
-		} else if (v1->type == RPN_PCHAR) {
-			int c = strcmp(v1->pchar, v2->pchar);
-			if (c == 0)
-				continue;
-			less = c < 0;
-		} else if (v1->type == RPN_DOUBLE) {
-			if (v1->dbl == v2->dbl)
-				continue;
-			less = v1->dbl < v2->dbl;
-		} else {
-			assert(!"unhandled type");
-			abort();
-		}
+static int
+top_cmp(const void *p1, const void *p2, void *arg)
+{
+	const struct top_row *r1 = *(const struct top_row **)p1;
+	const struct top_row *r2 = *(const struct top_row **)p2;
 
-		if (less == asc)
-			return -1;
-		else
-			return 1;
+	if (r1 == r2)
+		return 0;
+	return top_row_before(r1, r2, arg) ? -1 : 1;
+}
+
+static void
+top_print(struct top_rows *top, const struct order_conditions *order_by)
+{
+	if (top->count > 1)
+		csv_qsort_r(top->heap, top->count, sizeof(top->heap[0]),
+				top_cmp, (void *)order_by);
+
+	for (size_t i = 0; i < top->count; ++i) {
+		struct top_row *row = top->heap[i];
+
+		csv_values_set_row(&Params.row, row->buf, row->col_offs);
+		print_row(&Params.columns, &Params.row);
+		top_row_free(row, order_by->count);
 	}
 
-	return 0;
+	free(top->heap);
+	free(top->order);
 }
 
 int
@@ -411,10 +663,13 @@ main(int argc, char *argv[])
 	if (columns->count < 1)
 		abort();
 
+	csv_values_init(&Params.row, Nheaders);
 	csv_read_all_nofail(s, &next_row, &Params);
 
 	struct lines *lines = &Params.lines;
-	if (Params.order_by.count) {
+	if (Params.order_by.count && Params.has_limit) {
+		top_print(&Params.top, &Params.order_by);
+	} else if (Params.order_by.count) {
 		struct sort_params sort_params;
 		sort_params.lines = lines;
 		sort_params.order_by = &Params.order_by;
@@ -428,12 +683,15 @@ main(int argc, char *argv[])
 
 		for (size_t i = 0; i < lines->used; ++i) {
 			struct line *line = &lines->data[row_idx[i]];
-			print_row(&Params.columns, line->buf, line->col_offs);
+			csv_values_set_row(&Params.row, line->buf,
+					line->col_offs);
+			print_row(&Params.columns, &Params.row);
 		}
 
 		free(row_idx);
 	}
 
+	csv_values_fini(&Params.row);
 	csv_destroy_ctx(s);
 
 	if (Params.order_by.count) {
@@ -445,8 +703,6 @@ main(int argc, char *argv[])
 				if (order[j].type == RPN_PCHAR)
 					free(order[j].pchar);
 			free(order);
-
-			lines_free_one(line);
 		}
 
 		for (size_t i = 0; i < Params.order_by.count; ++i)
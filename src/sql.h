@@ -35,4 +35,6 @@ void sql_end_of_conditions();
 void sql_order_by();
 void sql_order_by_expr_done(bool asc);
 
+void sql_limit(long long limit);
+
 #endif
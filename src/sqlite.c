@@ -60,6 +60,9 @@ struct cb_params {
 	} *inserts;
 
 	size_t ntables;
+
+	char *unquoted;
+	size_t unquoted_size;
 };
 
 static int
@@ -121,10 +124,12 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 		} else {
 			const char *str = &buf[col_offs[i]];
 			if (str[0] == '"') {
-				char *unquoted = csv_unquot(str);
+				/* copied by sqlite, so the buffer can be reused */
+				const char *unquoted = csv_unquot_buf(str,
+						&params->unquoted,
+						&params->unquoted_size);
 				ret = sqlite3_bind_text(ins->insert, idx + 1,
 						unquoted, -1, SQLITE_TRANSIENT);
-				free(unquoted);
 			} else {
 				ret = sqlite3_bind_text(ins->insert, idx + 1,
 						str, -1, SQLITE_STATIC);
@@ -400,6 +405,8 @@ add_file(FILE *f, size_t num, sqlite3 *db, bool load_tables,
 	params.ntables = ntables;
 	params.inserts = xcalloc_nofail(ntables, sizeof(params.inserts[0]));
 	params.table_column = table_column;
+	params.unquoted = NULL;
+	params.unquoted_size = 0;
 
 	for (size_t i = 0; i < ntables; ++i) {
 		struct table *t = &tables[i];
@@ -443,6 +450,7 @@ add_file(FILE *f, size_t num, sqlite3 *db, bool load_tables,
 	free(tables);
 
 	free(params.inserts);
+	free(params.unquoted);
 
 	csv_destroy_ctx(s);
 }
@@ -481,12 +489,12 @@ print_val(sqlite3_stmt *select, size_t i)
 {
 	int type = sqlite3_column_type(select, i);
 	if (type == SQLITE_INTEGER) {
-		printf("%lld", sqlite3_column_int64(select, i));
+		csv_print_int(stdout, sqlite3_column_int64(select, i));
 	} else if (type == SQLITE_TEXT) {
 		const char *txt = (const char *)sqlite3_column_text(select, i);
 		csv_print_quoted(txt, strlen(txt));
 	} else if (type == SQLITE_FLOAT) {
-		printf("%f", sqlite3_column_double(select, i));
+		csv_print_double(stdout, sqlite3_column_double(select, i));
 	} else if (type == SQLITE_NULL) {
 		/* nothing to do here */
 	} else {
@@ -69,82 +69,109 @@ struct cb_params {
 
 	size_t table_column;
 	char *table;
+
+	struct csv_values row;
 };
 
 static int
-next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
+add_int(struct cb_params *params, size_t i)
 {
-	UNUSED(ncols);
-	struct cb_params *params = arg;
+	long long llval;
+	if (csv_values_int(&params->row, params->cols[i], &llval))
+		return -1;
 
-	if (params->table) {
-		const char *table = &buf[col_offs[params->table_column]];
-		if (strcmp(table, params->table) != 0) {
-			csv_print_line_reordered(stdout, buf, col_offs,
-					params->ncols, true, params->cols);
-
-			return 0;
-		}
+	if (llval > 0 && params->sums_int[i] > LLONG_MAX - llval) {
+		fprintf(stderr, "integer overflow\n");
+		return -1;
 	}
 
-	for (size_t i = 0; i < params->ncols; ++i) {
-		if (!params->active_cols[i])
-			continue;
+	if (llval < 0 && params->sums_int[i] < LLONG_MIN - llval) {
+		fprintf(stderr, "integer underflow\n");
+		return -1;
+	}
 
-		const char *val = &buf[col_offs[params->cols[i]]];
+	params->sums_int[i] += llval;
 
-		if (params->types[i] == TYPE_INT) {
-			long long llval;
-			if (strtoll_safe(val, &llval, 0))
-				return -1;
+	return 0;
+}
 
-			if (llval > 0 && params->sums_int[i] > LLONG_MAX - llval) {
-				fprintf(stderr, "integer overflow\n");
-				return -1;
-			}
+static int
+add_float(struct cb_params *params, size_t i)
+{
+	double dbl;
+	if (csv_values_float(&params->row, params->cols[i], &dbl))
+		return -1;
 
-			if (llval < 0 && params->sums_int[i] < LLONG_MIN - llval) {
-				fprintf(stderr, "integer underflow\n");
-				return -1;
-			}
+	params->sums_dbl[i] += dbl;
 
-			params->sums_int[i] += llval;
-		} else if (params->types[i] == TYPE_FLOAT) {
-			double dbl;
-			if (strtod_safe(val, &dbl))
-				return -1;
+	return 0;
+}
 
-			params->sums_dbl[i] += dbl;
-		} else {
-			const char *unquoted = val;
-			if (val[0] == '"')
-				unquoted = csv_unquot(val);
+static void
+add_string(struct cb_params *params, size_t i)
+{
+	const char *unquoted = csv_values_str(&params->row, params->cols[i]);
+	size_t len = strlen(unquoted);
+
+	size_t req = params->sep_len + len + 1;
+	if (req > params->str_sizes[i] - params->str_used[i]) {
+		params->str_sizes[i] *= 2;
+		if (params->str_sizes[i] - params->str_used[i] < req)
+			params->str_sizes[i] += req;
+
+		params->sums_str[i] =
+			xrealloc_nofail(params->sums_str[i],
+					params->str_sizes[i], 1);
+	}
 
-			size_t len = strlen(unquoted);
+	if (params->str_used[i] > 0 && params->sep_len) {
+		strcpy(&params->sums_str[i][params->str_used[i]],
+				params->sep);
+		params->str_used[i] += params->sep_len;
+	}
 
-			size_t req = params->sep_len + len + 1;
-			if (req > params->str_sizes[i] - params->str_used[i]) {
-				params->str_sizes[i] *= 2;
-				if (params->str_sizes[i] - params->str_used[i] < req)
-					params->str_sizes[i] += req;
+	memcpy(&params->sums_str[i][params->str_used[i]],
+			unquoted, len + 1);
+	params->str_used[i] += len;
+}
 
-				params->sums_str[i] =
-					xrealloc_nofail(params->sums_str[i],
-							params->str_sizes[i], 1);
+static int
+next_batch(const struct csv_batch *batch, void *arg)
+{
+	struct cb_params *params = arg;
+	size_t ncols = batch->ncols;
+
+	for (size_t r = 0; r < batch->nrows; ++r) {
+		const char *buf = &batch->buf[batch->row_offs[r]];
+		const size_t *col_offs = &batch->col_offs[r * ncols];
+
+		if (params->table) {
+			const char *table = &buf[col_offs[params->table_column]];
+			if (strcmp(table, params->table) != 0) {
+				csv_print_line_reordered(stdout, buf, col_offs,
+						params->ncols, true,
+						params->cols);
+				continue;
 			}
+		}
 
-			if (params->str_used[i] > 0 && params->sep_len) {
-				strcpy(&params->sums_str[i][params->str_used[i]],
-						params->sep);
-				params->str_used[i] += params->sep_len;
-			}
+		csv_values_set_row(&params->row, buf, col_offs);
+
+		for (size_t i = 0; i < params->ncols; ++i) {
+			if (!params->active_cols[i])
+				continue;
 
-			memcpy(&params->sums_str[i][params->str_used[i]],
-					unquoted, len + 1);
-			params->str_used[i] += len;
+			enum data_type type = params->types[i];
 
-			if (val[0] == '"')
-				free((char *)unquoted);
+			if (type == TYPE_INT) {
+				if (add_int(params, i))
+					return -1;
+			} else if (type == TYPE_FLOAT) {
+				if (add_float(params, i))
+					return -1;
+			} else {
+				add_string(params, i);
+			}
 		}
 	}
 
@@ -344,7 +371,10 @@ main(int argc, char *argv[])
 	free(results);
 	results = NULL;
 
-	csv_read_all_nofail(s, &next_row, &params);
+	csv_set_needed_columns_nofail(s, params.cols, params.ncols, false);
+	csv_values_init(&params.row, nheaders);
+	csv_read_batches_nofail(s, &next_batch, &params);
+	csv_values_fini(&params.row);
 
 	csv_destroy_ctx(s);
 
@@ -358,9 +388,11 @@ main(int argc, char *argv[])
 		if (!params.active_cols[i]) {
 			putchar(',');
 		} else if (params.types[i] == TYPE_INT) {
-			printf("%lld,", params.sums_int[i]);
+			csv_print_int(stdout, params.sums_int[i]);
+			putchar(',');
 		} else if (params.types[i] == TYPE_FLOAT) {
-			printf("%f,", params.sums_dbl[i]);
+			csv_print_double(stdout, params.sums_dbl[i]);
+			putchar(',');
 		} else {
 			csv_print_quoted(params.sums_str[i],
 					params.str_used[i]);
@@ -371,9 +403,9 @@ main(int argc, char *argv[])
 	size_t idx = params.ncols - 1;
 	if (params.active_cols[idx]) {
 		if (params.types[idx] == TYPE_INT)
-			printf("%lld", params.sums_int[idx]);
+			csv_print_int(stdout, params.sums_int[idx]);
 		else if (params.types[idx] == TYPE_FLOAT)
-			printf("%f", params.sums_dbl[idx]);
+			csv_print_double(stdout, params.sums_dbl[idx]);
 		else
 			csv_print_quoted(params.sums_str[idx],
 					params.str_used[idx]);
@@ -50,12 +50,11 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 	return lines_add(&params->lines, buf, col_offs, ncols);
 }
 
-static int
-print_row(const char *buf, const size_t *col_offs, size_t ncols, size_t *idx)
+static void
+print_row(struct csv_writer *out, const char *buf, const size_t *col_offs,
+		size_t ncols, size_t *idx)
 {
-	csv_print_line_reordered(stdout, buf, col_offs, ncols, true, idx);
-
-	return 0;
+	csv_writer_line_reordered(out, buf, col_offs, ncols, true, idx);
 }
 
 struct input {
@@ -187,6 +186,9 @@ main(int argc, char *argv[])
 
 	csv_print_headers(stdout, headers, nheaders);
 
+	struct csv_writer out;
+	csv_writer_init(&out, stdout, CSV_WRITER_DEFAULT_SIZE);
+
 	for (size_t i = 0; i < ninputs; ++i) {
 		struct input *in = &inputs[i];
 		struct cb_params params;
@@ -199,8 +201,8 @@ main(int argc, char *argv[])
 		for (size_t j = lines->used; j > 0; --j) {
 			size_t k = j - 1;
 			struct line *line = &lines->data[k];
-			print_row(line->buf, line->col_offs, nheaders, in->idx);
-			lines_free_one(line);
+			print_row(&out, line->buf, line->col_offs, nheaders,
+					in->idx);
 		}
 
 		csv_destroy_ctx(in->s);
@@ -209,6 +211,7 @@ main(int argc, char *argv[])
 		fclose(in->f);
 	}
 
+	csv_writer_fini(&out);
 	free(inputs);
 
 	return 0;
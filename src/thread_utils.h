@@ -51,6 +51,16 @@ cnd_signal_nofail(cnd_t *c)
 	}
 }
 
+static inline void
+cnd_broadcast_nofail(cnd_t *c)
+{
+	int ret = cnd_broadcast(c);
+	if (ret != thrd_success) {
+		fprintf(stderr, "cnd_broadcast failed: %d\n", ret);
+		exit(2);
+	}
+}
+
 static inline void
 cnd_wait_nofail(cnd_t *c, mtx_t *m)
 {
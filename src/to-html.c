@@ -29,6 +29,9 @@ struct cb_params {
 	bool *is_color_column;
 	size_t *color_column_index;
 	enum alignment *alignments;
+
+	char *unquoted;
+	size_t unquoted_size;
 };
 
 static const struct option opts[] = {
@@ -144,15 +147,8 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 			printf("  <td>");
 		}
 
-		const char *str = buf + col_offs[i];
-		const char *unquoted = str;
-		if (str[0] == '"')
-			unquoted = csv_unquot(str);
-
-		print(unquoted, SIZE_MAX);
-
-		if (str[0] == '"')
-			free((char *)unquoted);
+		print(csv_unquot_buf(buf + col_offs[i], &params->unquoted,
+				&params->unquoted_size), SIZE_MAX);
 
 		printf("</td>\n");
 	}
@@ -177,6 +173,8 @@ main(int argc, char *argv[])
 
 	params.split_results = NULL;
 	params.split_results_max_size = 0;
+	params.unquoted = NULL;
+	params.unquoted_size = 0;
 
 	setlocale(LC_ALL, "");
 	setlocale(LC_NUMERIC, "C");
@@ -386,6 +384,7 @@ main(int argc, char *argv[])
 	free(params.color_column_index);
 	free(params.alignments);
 	free(params.split_results);
+	free(params.unquoted);
 
 	csv_destroy_ctx(s);
 
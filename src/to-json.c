@@ -20,6 +20,9 @@ struct cb_params {
 	const struct col_header *headers;
 	const bool *quote;
 	bool first_row;
+
+	char *unquoted;
+	size_t unquoted_size;
 };
 
 static const struct option opts[] = {
@@ -94,14 +97,8 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 
 		const char *str = buf + col_offs[i];
 		if (params->quote[i]) {
-			const char *unquoted = str;
-			if (str[0] == '"')
-				unquoted = csv_unquot(str);
-
-			print(unquoted);
-
-			if (str[0] == '"')
-				free((char *)unquoted);
+			print(csv_unquot_buf(str, &params->unquoted,
+					&params->unquoted_size));
 		} else {
 			printf("%s", str);
 		}
@@ -148,6 +145,8 @@ main(int argc, char *argv[])
 	size_t nheaders = csv_get_headers(s, &headers);
 	params.headers = headers;
 	params.first_row = true;
+	params.unquoted = NULL;
+	params.unquoted_size = 0;
 
 	bool *quote = xmalloc_nofail(nheaders, sizeof(quote[0]));
 	for (size_t i = 0; i < nheaders; ++i) {
@@ -168,6 +167,7 @@ main(int argc, char *argv[])
 	       "}\n");
 
 	csv_destroy_ctx(s);
+	free(params.unquoted);
 	free(quote);
 
 	return 0;
@@ -21,6 +21,9 @@
 struct cb_params {
 	const struct col_header *headers;
 	bool generic_names;
+
+	char *unquoted;
+	size_t unquoted_size;
 };
 
 static const struct option opts[] = {
@@ -80,15 +83,8 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 		else
 			printf("   <%s>", params->headers[i].name);
 
-		const char *str = buf + col_offs[i];
-		const char *unquoted = str;
-		if (str[0] == '"')
-			unquoted = csv_unquot(str);
-
-		print(unquoted);
-
-		if (str[0] == '"')
-			free((char *)unquoted);
+		print(csv_unquot_buf(buf + col_offs[i], &params->unquoted,
+				&params->unquoted_size));
 
 		if (params->generic_names)
 			printf("</column>\n");
@@ -117,6 +113,8 @@ main(int argc, char *argv[])
 	setlocale(LC_NUMERIC, "C");
 
 	params.generic_names = false;
+	params.unquoted = NULL;
+	params.unquoted_size = 0;
 
 	while ((opt = getopt_long(argc, argv, "", opts, NULL)) != -1) {
 		switch (opt) {
@@ -243,6 +241,7 @@ main(int argc, char *argv[])
 		"</root>\n");
 
 	csv_destroy_ctx(s);
+	free(params.unquoted);
 
 	return 0;
 }
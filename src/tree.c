@@ -468,11 +468,6 @@ main(int argc, char *argv[])
 			filter != NULL, filter == NULL, print_lvl);
 	}
 
-	for (size_t i = 0; i < lines->used; ++i) {
-		struct line *line = &lines->data[i];
-
-		lines_free_one(line);
-	}
 	lines_fini(lines);
 
 	csv_destroy_ctx(s);
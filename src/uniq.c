@@ -53,6 +53,9 @@ struct cb_params {
 
 	size_t table_column;
 	char *table;
+
+	char *unquoted;
+	size_t unquoted_size;
 };
 
 static int
@@ -74,11 +77,8 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 
 	for (size_t i = 0; i < params->ncols; ++i) {
 		const char *col = &buf[col_offs[params->cols[i]]];
-
-		const char *unquoted = col;
-
-		if (col[0] == '"')
-			unquoted = csv_unquot(col);
+		const char *unquoted = csv_unquot_buf(col, &params->unquoted,
+				&params->unquoted_size);
 
 		if (params->bufs[i].sz == 0 ||
 				strcmp(params->bufs[i].space, unquoted) != 0) {
@@ -94,9 +94,6 @@ next_row(const char *buf, const size_t *col_offs, size_t ncols, void *arg)
 
 			memcpy(params->bufs[i].space, unquoted, len + 1);
 		}
-
-		if (col[0] == '"')
-			free((char *)unquoted);
 	}
 
 	if (print) {
@@ -126,6 +123,8 @@ main(int argc, char *argv[])
 
 	params.table = NULL;
 	params.table_column = SIZE_MAX;
+	params.unquoted = NULL;
+	params.unquoted_size = 0;
 
 	while ((opt = getopt_long(argc, argv, "c:rsST:", opts, NULL)) != -1) {
 		switch (opt) {
@@ -224,6 +223,7 @@ main(int argc, char *argv[])
 
 	csv_print_header(stdout, &headers[params.cols[params.ncols - 1]], '\n');
 
+	csv_set_needed_columns_nofail(s, params.cols, params.ncols, false);
 	csv_read_all_nofail(s, &next_row, &params);
 
 	for (size_t i = 0; i < params.ncols; ++i)
@@ -232,6 +232,7 @@ main(int argc, char *argv[])
 	free(params.cols);
 	free(params.bufs);
 	free(params.table);
+	free(params.unquoted);
 
 	csv_destroy_ctx(s);
 
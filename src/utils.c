@@ -7,6 +7,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <float.h>
 #include <limits.h>
 #include <math.h>
 #include <stdint.h>
@@ -41,30 +42,202 @@ csv_print_headers(FILE *out, const struct col_header *headers, size_t nheaders)
 	csv_print_header(out, &headers[nheaders - 1], '\n');
 }
 
+static struct csv_writer *Writers;
+
+static void
+flush_writers(void)
+{
+	for (struct csv_writer *w = Writers; w; w = w->next)
+		csv_writer_flush(w);
+}
+
 void
-csv_print_line(FILE *out, const char *buf, const size_t *col_offs,
+csv_writer_init(struct csv_writer *w, FILE *out, size_t size)
+{
+	static bool registered = false;
+
+	w->out = out;
+	w->buf = xmalloc_nofail(size, 1);
+	w->size = size;
+	w->used = 0;
+	w->owned = true;
+	w->line_buffered = isatty(fileno(out));
+
+	/* don't lose buffered rows when some error ends the process */
+	if (!registered) {
+		atexit(flush_writers);
+		registered = true;
+	}
+	w->next = Writers;
+	Writers = w;
+}
+
+/* Initializes writer which uses caller-provided buffer. */
+void
+csv_writer_init_buf(struct csv_writer *w, FILE *out, char *buf, size_t size)
+{
+	w->out = out;
+	w->buf = buf;
+	w->size = size;
+	w->used = 0;
+	w->owned = false;
+	w->line_buffered = false;
+	w->next = NULL;
+}
+
+void
+csv_writer_flush(struct csv_writer *w)
+{
+	if (w->used == 0)
+		return;
+
+	fwrite(w->buf, 1, w->used, w->out);
+	w->used = 0;
+}
+
+void
+csv_writer_fini(struct csv_writer *w)
+{
+	csv_writer_flush(w);
+	if (w->owned) {
+		struct csv_writer **prev = &Writers;
+		while (*prev != w)
+			prev = &(*prev)->next;
+		*prev = w->next;
+
+		free(w->buf);
+	}
+	w->buf = NULL;
+	w->size = 0;
+}
+
+void
+csv_writer_write_slow(struct csv_writer *w, const char *str, size_t len)
+{
+	csv_writer_flush(w);
+
+	if (len >= w->size) {
+		fwrite(str, 1, len, w->out);
+		return;
+	}
+
+	memcpy(w->buf, str, len);
+	w->used = len;
+}
+
+void
+csv_writer_line(struct csv_writer *w, const char *buf, const size_t *col_offs,
 		size_t ncols, bool nl)
 {
 	for (size_t i = 0; i < ncols - 1; ++i) {
-		fputs(&buf[col_offs[i]], out);
-		fputc(',', out);
+		csv_writer_puts(w, &buf[col_offs[i]]);
+		csv_writer_putc(w, ',');
+	}
+	csv_writer_puts(w, &buf[col_offs[ncols - 1]]);
+	if (nl) {
+		csv_writer_putc(w, '\n');
+		if (w->line_buffered)
+			csv_writer_flush(w);
 	}
-	fputs(&buf[col_offs[ncols - 1]], out);
-	if (nl)
-		fputc('\n', out);
 }
 
 void
-csv_print_line_reordered(FILE *out, const char *buf, const size_t *col_offs,
-		size_t ncols, bool nl, const size_t *idx)
+csv_writer_line_reordered(struct csv_writer *w, const char *buf,
+		const size_t *col_offs, size_t ncols, bool nl,
+		const size_t *idx)
 {
 	for (size_t i = 0; i < ncols - 1; ++i) {
-		fputs(&buf[col_offs[idx[i]]], out);
-		fputc(',', out);
+		csv_writer_puts(w, &buf[col_offs[idx[i]]]);
+		csv_writer_putc(w, ',');
+	}
+	csv_writer_puts(w, &buf[col_offs[idx[ncols - 1]]]);
+	if (nl) {
+		csv_writer_putc(w, '\n');
+		if (w->line_buffered)
+			csv_writer_flush(w);
+	}
+}
+
+/*
+ * Returns length of the row, as produced by the parser, without new line
+ * character.
+ */
+size_t
+csv_row_length(const char *buf, const size_t *col_offs, size_t ncols)
+{
+	return col_offs[ncols - 1] + strlen(&buf[col_offs[ncols - 1]]);
+}
+
+/*
+ * Prints whole row (with new line) as it was in the input. Row must come
+ * straight from the parser (or be a copy of such row) - columns must be
+ * stored in order and separated by exactly one byte (NUL or the original
+ * comma), which is where comma was in the input. Columns don't have to be
+ * NUL-terminated (see csv_set_needed_columns).
+ */
+void
+csv_writer_raw_row(struct csv_writer *w, const char *buf, size_t len,
+		const size_t *col_offs, size_t ncols)
+{
+	if (w->size - w->used < len + 1) {
+		csv_writer_flush(w);
+
+		/* too big for the buffer, print it column by column */
+		if (w->size < len + 1) {
+			for (size_t i = 1; i < ncols; ++i) {
+				csv_writer_write(w, &buf[col_offs[i - 1]],
+						col_offs[i] - 1 - col_offs[i - 1]);
+				csv_writer_putc(w, ',');
+			}
+			csv_writer_write(w, &buf[col_offs[ncols - 1]],
+					len - col_offs[ncols - 1]);
+			csv_writer_putc(w, '\n');
+
+			if (w->line_buffered)
+				csv_writer_flush(w);
+			return;
+		}
 	}
-	fputs(&buf[col_offs[idx[ncols - 1]]], out);
-	if (nl)
-		fputc('\n', out);
+
+	char *dst = &w->buf[w->used];
+	memcpy(dst, buf, len);
+	for (size_t i = 1; i < ncols; ++i)
+		dst[col_offs[i] - 1] = ',';
+	dst[len] = '\n';
+	w->used += len + 1;
+
+	if (w->line_buffered)
+		csv_writer_flush(w);
+}
+
+/*
+ * Size of the on-stack buffer used by the printing helpers below. Rows
+ * shorter than that reach the stream with a single fwrite.
+ */
+#define LINE_BUF_SIZE 4096
+
+void
+csv_print_line(FILE *out, const char *buf, const size_t *col_offs,
+		size_t ncols, bool nl)
+{
+	char tmp[LINE_BUF_SIZE];
+	struct csv_writer w;
+
+	csv_writer_init_buf(&w, out, tmp, sizeof(tmp));
+	csv_writer_line(&w, buf, col_offs, ncols, nl);
+	csv_writer_flush(&w);
+}
+
+void
+csv_print_line_reordered(FILE *out, const char *buf, const size_t *col_offs,
+		size_t ncols, bool nl, const size_t *idx)
+{
+	char tmp[LINE_BUF_SIZE];
+	struct csv_writer w;
+
+	csv_writer_init_buf(&w, out, tmp, sizeof(tmp));
+	csv_writer_line_reordered(&w, buf, col_offs, ncols, nl, idx);
+	csv_writer_flush(&w);
 }
 
 void
@@ -122,11 +295,86 @@ csv_str_replace(const char *str, const char *pattern, const char *replacement,
 	}
 }
 
+static inline unsigned
+digit_value(unsigned char c)
+{
+	if ((unsigned)(c - '0') < 10)
+		return c - '0';
+
+	c |= 0x20; /* lower case */
+	if ((unsigned)(c - 'a') < 6)
+		return c - 'a' + 10;
+
+	return UINT_MAX;
+}
+
+/*
+ * Parses integers written in the usual way: optional sign, optional base
+ * prefix and digits. Returns false if the string has to be parsed by strtoll
+ * (no digits, white space after the sign, etc), otherwise it stores the value
+ * and the end of parsed string just like strtoll, including LLONG_MIN /
+ * LLONG_MAX and *overflow set to true for values out of range.
+ */
+static bool
+parse_ll(const char *str, int base, long long *val, const char **end,
+		bool *overflow)
+{
+	bool neg = false;
+	if (str[0] == '-' || str[0] == '+') {
+		neg = str[0] == '-';
+		str++;
+	}
+
+	if (base == 0) {
+		if (str[0] != '0') {
+			base = 10;
+		} else if ((str[1] | 0x20) == 'x') {
+			base = 16;
+			str += 2;
+		} else {
+			/* leading zero is an octal digit too */
+			base = 8;
+		}
+	} else if (base == 16 && str[0] == '0' && (str[1] | 0x20) == 'x') {
+		str += 2;
+	}
+
+	const char *digits = str;
+	unsigned long long acc = 0;
+	bool ovf = false;
+	unsigned d;
+
+	while ((d = digit_value((unsigned char)*str)) < (unsigned)base) {
+		ovf |= __builtin_mul_overflow(acc, (unsigned)base, &acc);
+		ovf |= __builtin_add_overflow(acc, d, &acc);
+		str++;
+	}
+
+	if (str == digits)
+		return false;
+
+	if (neg)
+		ovf |= acc > (unsigned long long)LLONG_MAX + 1;
+	else
+		ovf |= acc > LLONG_MAX;
+
+	*end = str;
+	*overflow = ovf;
+	if (ovf)
+		*val = neg ? LLONG_MIN : LLONG_MAX;
+	else if (neg && acc > 0)
+		*val = -(long long)(acc - 1) - 1;
+	else
+		*val = (long long)acc;
+
+	return true;
+}
+
 int
 strtoll_safe2(const char *str, long long *val, int base, bool verbose)
 {
 	const char *origstr = str;
-	char *end;
+	const char *end;
 
 	while (isspace(str[0]))
 		str++;
@@ -144,7 +392,16 @@ strtoll_safe2(const char *str, long long *val, int base, bool verbose)
 	}
 
 	errno = 0;
-	long long llval = strtoll(str, &end, base);
+	long long llval;
+	bool overflow;
+	if (parse_ll(str, base, &llval, &end, &overflow)) {
+		if (overflow)
+			errno = ERANGE;
+	} else {
+		char *e;
+		llval = strtoll(str, &e, base);
+		end = e;
+	}
 
 	if (llval == LLONG_MIN && errno) {
 		if (verbose) {
@@ -327,11 +584,134 @@ strtou_safe(const char *str, unsigned *val, int base)
 	return 0;
 }
 
+#if FLT_EVAL_METHOD == 0
+static const double Exact_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+#define MAX_EXACT_POW10 22
+#define MAX_EXACT_INT (1ULL << DBL_MANT_DIG)
+
+/*
+ * Parses plain decimal numbers ([+-]digits[.digits][e[+-]digits]) whose
+ * significand and power of 10 are both exactly representable as doubles.
+ * Then one multiplication or division gives a correctly rounded result,
+ * the same as strtod. Returns false for everything else (inf, nan, hex
+ * floats, white space, more than 19 significant digits, big exponents,
+ * garbage at the end), which has to be parsed by strtod.
+ */
+static bool
+parse_double(const char *str, double *val)
+{
+	bool neg = false;
+	if (str[0] == '-' || str[0] == '+') {
+		neg = str[0] == '-';
+		str++;
+	}
+
+	unsigned long long m = 0;
+	unsigned ndigits = 0;
+	int exp10 = 0;
+	bool any = false;
+	unsigned d;
+
+	while ((d = (unsigned)(*str - '0')) < 10) {
+		any = true;
+		if (m || d) {
+			if (ndigits++ == 19)
+				return false;
+			m = m * 10 + d;
+		}
+		str++;
+	}
+
+	if (*str == '.') {
+		str++;
+		while ((d = (unsigned)(*str - '0')) < 10) {
+			any = true;
+			if (m || d) {
+				if (ndigits++ == 19)
+					return false;
+				m = m * 10 + d;
+			}
+			exp10--;
+			str++;
+		}
+	}
+
+	if (!any)
+		return false;
+
+	if ((*str | 0x20) == 'e') {
+		str++;
+		bool eneg = false;
+		if (str[0] == '-' || str[0] == '+') {
+			eneg = str[0] == '-';
+			str++;
+		}
+
+		if ((unsigned)(*str - '0') >= 10)
+			return false;
+
+		int e = 0;
+		while ((d = (unsigned)(*str - '0')) < 10) {
+			if (e < 100000)
+				e = e * 10 + (int)d;
+			str++;
+		}
+
+		exp10 += eneg ? -e : e;
+	}
+
+	if (*str)
+		return false;
+
+	if (m == 0) {
+		*val = neg ? -0.0 : 0.0;
+		return true;
+	}
+
+	if (m > MAX_EXACT_INT)
+		return false;
+
+	double dbl;
+	if (exp10 < 0) {
+		if (exp10 < -MAX_EXACT_POW10)
+			return false;
+		dbl = (double)m / Exact_pow10[-exp10];
+	} else {
+		/* move the excess to the significand if it stays exact */
+		for (; exp10 > MAX_EXACT_POW10; exp10--) {
+			m *= 10;
+			if (m > MAX_EXACT_INT)
+				return false;
+		}
+		dbl = (double)m * Exact_pow10[exp10];
+	}
+
+	*val = neg ? -dbl : dbl;
+	return true;
+}
+#else
+static bool
+parse_double(const char *str, double *val)
+{
+	/* without exact double arithmetic the fast path isn't correct */
+	UNUSED(str);
+	UNUSED(val);
+	return false;
+}
+#endif
+
 int
 strtod_safe2(const char *str, double *val, bool verbose)
 {
 	char *end;
 
+	if (parse_double(str, val))
+		return 0;
+
 	errno = 0;
 	double dbl = strtod(str, &end);
 
@@ -372,6 +752,154 @@ strtod_safe(const char *str, double *val)
 	return strtod_safe2(str, val, true);
 }
 
+static const char Digit_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/*
+ * Writes decimal representation of val, two digits at a time, so that
+ * its last digit is just before end. Returns the first digit.
+ */
+static inline char *
+format_digits(char *end, unsigned long long val)
+{
+	while (val >= 100) {
+		unsigned idx = (unsigned)(val % 100) * 2;
+		val /= 100;
+		end -= 2;
+		memcpy(end, &Digit_pairs[idx], 2);
+	}
+
+	if (val >= 10) {
+		end -= 2;
+		memcpy(end, &Digit_pairs[val * 2], 2);
+	} else {
+		*--end = (char)('0' + val);
+	}
+
+	return end;
+}
+
+/* The same as sprintf(buf, "%lld", val), returns length of the string. */
+size_t
+csv_format_int(char *buf, long long val)
+{
+	char tmp[24];
+	char *end = tmp + sizeof(tmp);
+	unsigned long long uval = (unsigned long long)val;
+
+	if (val < 0)
+		uval = 0 - uval;
+
+	char *start = format_digits(end, uval);
+	if (val < 0)
+		*--start = '-';
+
+	size_t len = (size_t)(end - start);
+	memcpy(buf, start, len);
+	buf[len] = 0;
+
+	return len;
+}
+
+/*
+ * The same as sprintf(buf, "%f", val) (6 digits after the decimal point,
+ * rounded from the exact binary value, ties to even), returns length of
+ * the string. Values which don't fit in 64-bit integer, inf and nan are
+ * passed to snprintf.
+ */
+size_t
+csv_format_double(char *buf, double val)
+{
+	double abs = fabs(val);
+
+#ifdef __SIZEOF_INT128__
+	if (abs < 0x1p63) {
+		unsigned long long ipart = (unsigned long long)abs;
+		/* exact, because abs and ipart have the same exponent */
+		double frac = abs - (double)ipart;
+		unsigned long long fpart = 0;
+
+		if (frac != 0) {
+			uint64_t bits;
+			memcpy(&bits, &frac, sizeof(bits));
+
+			/* frac = mant * 2^-shift */
+			unsigned exp = (unsigned)(bits >> 52) & 0x7ff;
+			uint64_t mant = bits & ((1ULL << 52) - 1);
+			unsigned shift;
+			if (exp == 0) {
+				shift = 1074;
+			} else {
+				mant |= 1ULL << 52;
+				shift = 1075 - exp;
+			}
+
+			/* frac < 1, so shift > 52 and fpart < 10^6 */
+			if (shift < 128) {
+				unsigned __int128 v = (unsigned __int128)mant * 1000000;
+				unsigned __int128 half = (unsigned __int128)1 << (shift - 1);
+				unsigned __int128 rem = v & ((half << 1) - 1);
+
+				fpart = (unsigned long long)(v >> shift);
+				if (rem > half || (rem == half && (fpart & 1)))
+					fpart++;
+			}
+
+			if (fpart == 1000000) {
+				fpart = 0;
+				ipart++;
+			}
+		}
+
+		char tmp[32];
+		char *end = tmp + sizeof(tmp);
+		char *start = end - 6;
+
+		/* 6 digits after the decimal point, with leading zeroes */
+		for (char *p = format_digits(end, fpart); p > start; )
+			*--p = '0';
+
+		*--start = '.';
+		start = format_digits(start, ipart);
+		if (signbit(val))
+			*--start = '-';
+
+		size_t len = (size_t)(end - start);
+		memcpy(buf, start, len);
+		buf[len] = 0;
+
+		return len;
+	}
+#endif
+
+	return (size_t)snprintf(buf, CSV_NUMBER_BUF_SIZE, "%f", val);
+}
+
+void
+csv_print_int(FILE *out, long long val)
+{
+	char buf[CSV_NUMBER_BUF_SIZE];
+	size_t len = csv_format_int(buf, val);
+	fwrite(buf, 1, len, out);
+}
+
+void
+csv_print_double(FILE *out, double val)
+{
+	char buf[CSV_NUMBER_BUF_SIZE];
+	size_t len = csv_format_double(buf, val);
+	fwrite(buf, 1, len, out);
+}
+
 char *
 strnchr(const char *str, int c, size_t len)
 {
@@ -422,33 +950,44 @@ csv_requires_quoting(const char *str, size_t len)
 }
 
 void
-csv_print_quoted(const char *str, size_t len)
+csv_writer_quoted(struct csv_writer *w, const char *str, size_t len)
 {
 	const char *comma = strnchr(str, ',', len);
 	const char *nl = strnchr(str, '\n', len);
 	const char *quot = strnchr(str, '"', len);
 	if (!comma && !nl && !quot) {
-		fwrite(str, 1, len, stdout);
+		csv_writer_write(w, str, len);
 		return;
 	}
-	fputc('"', stdout);
+	csv_writer_putc(w, '"');
 	if (!quot) {
-		fwrite(str, 1, len, stdout);
-		fputc('"', stdout);
+		csv_writer_write(w, str, len);
+		csv_writer_putc(w, '"');
 		return;
 	}
 
 	do {
 		size_t curlen = (uintptr_t)quot - (uintptr_t)str + 1;
-		fwrite(str, 1, curlen, stdout);
+		csv_writer_write(w, str, curlen);
 		str += curlen;
-		fputc('"', stdout);
+		csv_writer_putc(w, '"');
 		len -= curlen;
 		quot = strnchr(str, '"', len);
 	} while (quot);
 
-	fwrite(str, 1, len, stdout);
-	fputc('"', stdout);
+	csv_writer_write(w, str, len);
+	csv_writer_putc(w, '"');
+}
+
+void
+csv_print_quoted(const char *str, size_t len)
+{
+	char tmp[LINE_BUF_SIZE];
+	struct csv_writer w;
+
+	csv_writer_init_buf(&w, stdout, tmp, sizeof(tmp));
+	csv_writer_quoted(&w, str, len);
+	csv_writer_flush(&w);
 }
 
 char *
@@ -476,6 +1015,109 @@ csv_unquot(const char *str)
 	return n;
 }
 
+void
+csv_values_init(struct csv_values *v, size_t ncols)
+{
+	v->buf = NULL;
+	v->col_offs = NULL;
+	/* entries start with generation 0, so nothing is valid yet */
+	v->gen = 0;
+	v->vals = xcalloc_nofail(ncols, sizeof(v->vals[0]));
+	v->ncols = ncols;
+}
+
+void
+csv_values_fini(struct csv_values *v)
+{
+	for (size_t i = 0; i < v->ncols; ++i)
+		free(v->vals[i].unquoted);
+	free(v->vals);
+	v->vals = NULL;
+	v->ncols = 0;
+}
+
+int
+csv_values_int(struct csv_values *v, size_t col, long long *val)
+{
+	struct csv_value *cv = &v->vals[col];
+	if (cv->int_gen != v->gen) {
+		const char *str = &v->buf[v->col_offs[col]];
+		if (strtoll_safe(str, &cv->llong, 0))
+			return -1;
+		cv->int_gen = v->gen;
+	}
+
+	*val = cv->llong;
+	return 0;
+}
+
+int
+csv_values_float(struct csv_values *v, size_t col, double *val)
+{
+	struct csv_value *cv = &v->vals[col];
+	if (cv->dbl_gen != v->gen) {
+		const char *str = &v->buf[v->col_offs[col]];
+		if (strtod_safe(str, &cv->dbl))
+			return -1;
+		cv->dbl_gen = v->gen;
+	}
+
+	*val = cv->dbl;
+	return 0;
+}
+
+const char *
+csv_values_str(struct csv_values *v, size_t col)
+{
+	const char *str = &v->buf[v->col_offs[col]];
+
+	if (str[0] != '"')
+		return str;
+
+	struct csv_value *cv = &v->vals[col];
+	if (cv->str_gen != v->gen) {
+		csv_unquot_buf(str, &cv->unquoted, &cv->unquoted_size);
+		cv->str_gen = v->gen;
+	}
+
+	return cv->unquoted;
+}
+
+/*
+ * Returns str without quotes. Strings which are not quoted are returned as
+ * they are. Quoted ones are unquoted into *buf, which is grown when needed
+ * (*size is its size) and can be reused for the next string.
+ */
+const char *
+csv_unquot_buf(const char *str, char **buf, size_t *size)
+{
+	if (str[0] != '"')
+		return str;
+
+	size_t len = strlen(str);
+	if (str[len - 1] != '"') {
+		fprintf(stderr, "internal error - can't unquot string that is not quoted\n");
+		abort();
+	}
+
+	if (len > *size) {
+		free(*buf);
+		*buf = xmalloc_nofail(len, 1);
+		*size = len;
+	}
+
+	char *n = *buf;
+	size_t idx = 0;
+	for (size_t i = 1; i < len - 1; ++i) {
+		n[idx++] = str[i];
+		if (str[i] == '"')
+			++i;
+	}
+	n[idx] = 0;
+
+	return n;
+}
+
 #if 0
 void
 csv_unquot_in_place(char *str)
@@ -1043,12 +1685,102 @@ describe_version(FILE *out)
 	fprintf(out, "      --version              output version information and exit\n");
 }
 
+struct csv_arena_chunk {
+	struct csv_arena_chunk *next;
+	size_t size;
+	size_t data[];
+};
+
+void
+csv_arena_init(struct csv_arena *arena, size_t chunk_size)
+{
+	arena->chunks = NULL;
+	arena->used = 0;
+	arena->chunk_size = chunk_size;
+}
+
+/*
+ * Returns "len" bytes from the current chunk, aligned for size_t.
+ * Starts a new chunk when there's not enough space left.
+ */
+void *
+csv_arena_alloc(struct csv_arena *arena, size_t len)
+{
+	struct csv_arena_chunk *chunk = arena->chunks;
+
+	len = (len + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+
+	if (!chunk || chunk->size - arena->used < len) {
+		size_t size = arena->chunk_size;
+		if (size < len)
+			size = len;
+
+		chunk = xmalloc(sizeof(*chunk) + size, 1);
+		if (!chunk)
+			return NULL;
+
+		chunk->next = arena->chunks;
+		chunk->size = size;
+		arena->chunks = chunk;
+		arena->used = 0;
+	}
+
+	void *ret = (char *)chunk->data + arena->used;
+	arena->used += len;
+
+	return ret;
+}
+
+char *
+csv_arena_strndup(struct csv_arena *arena, const char *str, size_t len)
+{
+	char *ret = csv_arena_alloc(arena, len + 1);
+	if (!ret)
+		return NULL;
+
+	memcpy(ret, str, len);
+	ret[len] = 0;
+
+	return ret;
+}
+
+static void
+arena_free_chunks(struct csv_arena_chunk *chunk)
+{
+	while (chunk) {
+		struct csv_arena_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+}
+
+/* Frees everything except the newest chunk, which is reused. */
+void
+csv_arena_reset(struct csv_arena *arena)
+{
+	if (arena->chunks) {
+		arena_free_chunks(arena->chunks->next);
+		arena->chunks->next = NULL;
+	}
+
+	arena->used = 0;
+}
+
+void
+csv_arena_fini(struct csv_arena *arena)
+{
+	arena_free_chunks(arena->chunks);
+	arena->chunks = NULL;
+	arena->used = 0;
+}
+
 void
 lines_init(struct lines *lines)
 {
 	lines->data = NULL;
 	lines->size = 0;
 	lines->used = 0;
+	csv_arena_init(&lines->arena, 1024 * 1024);
 }
 
 int
@@ -1072,17 +1804,13 @@ lines_add(struct lines *lines, const char *buf, const size_t *col_offs,
 	struct line *line = &lines->data[lines->used];
 
 	size_t len = col_offs[ncols - 1] + strlen(buf + col_offs[ncols - 1]) + 1;
-
-	line->buf = xmalloc(len, 1);
-	if (!line->buf)
-		return -1;
-
 	size_t col_offs_size = ncols * sizeof(col_offs[0]);
-	line->col_offs = xmalloc(col_offs_size, 1);
-	if (!line->col_offs) {
-		free(line->buf);
+
+	/* offsets go first, so that they are always aligned */
+	line->col_offs = csv_arena_alloc(&lines->arena, col_offs_size + len);
+	if (!line->col_offs)
 		return -1;
-	}
+	line->buf = (char *)line->col_offs + col_offs_size;
 
 	memcpy(line->buf, buf, len);
 	memcpy(line->col_offs, col_offs, col_offs_size);
@@ -1091,15 +1819,10 @@ lines_add(struct lines *lines, const char *buf, const size_t *col_offs,
 	return 0;
 }
 
-void
-lines_free_one(struct line *line)
-{
-	free(line->buf);
-	free(line->col_offs);
-}
-
 void
 lines_fini(struct lines *lines)
 {
+	csv_arena_fini(&lines->arena);
 	free(lines->data);
+	lines_init(lines);
 }
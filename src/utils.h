@@ -11,6 +11,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <string.h>
 #include <time.h>
 
 #include "parse.h"
@@ -32,6 +33,72 @@ void csv_print_line_reordered(FILE *out, const char *buf,
 		const size_t *col_offs, size_t ncols, bool nl,
 		const size_t *idx);
 
+/*
+ * Output buffer which collects many rows in memory and hands them to the
+ * underlying stream in big chunks. Data appended to the writer reaches
+ * the stream only on flush, so writer must be flushed before anything else
+ * is printed to the same stream. Writers created by csv_writer_init are
+ * also flushed when the process exits and after every row when the stream
+ * is a terminal.
+ */
+struct csv_writer {
+	FILE *out;
+	char *buf;
+	size_t size;
+	size_t used;
+	bool owned;
+	bool line_buffered;
+	struct csv_writer *next;
+};
+
+#define CSV_WRITER_DEFAULT_SIZE (256 * 1024)
+
+void csv_writer_init(struct csv_writer *w, FILE *out, size_t size);
+void csv_writer_init_buf(struct csv_writer *w, FILE *out, char *buf,
+		size_t size);
+void csv_writer_flush(struct csv_writer *w);
+void csv_writer_fini(struct csv_writer *w);
+
+void csv_writer_write_slow(struct csv_writer *w, const char *str, size_t len);
+
+static inline void
+csv_writer_write(struct csv_writer *w, const char *str, size_t len)
+{
+	if (w->size - w->used < len) {
+		csv_writer_write_slow(w, str, len);
+		return;
+	}
+
+	memcpy(&w->buf[w->used], str, len);
+	w->used += len;
+}
+
+static inline void
+csv_writer_putc(struct csv_writer *w, char c)
+{
+	if (w->used == w->size)
+		csv_writer_flush(w);
+
+	w->buf[w->used++] = c;
+}
+
+static inline void
+csv_writer_puts(struct csv_writer *w, const char *str)
+{
+	csv_writer_write(w, str, strlen(str));
+}
+
+void csv_writer_line(struct csv_writer *w, const char *buf,
+		const size_t *col_offs, size_t ncols, bool nl);
+void csv_writer_line_reordered(struct csv_writer *w, const char *buf,
+		const size_t *col_offs, size_t ncols, bool nl,
+		const size_t *idx);
+void csv_writer_quoted(struct csv_writer *w, const char *str, size_t len);
+
+size_t csv_row_length(const char *buf, const size_t *col_offs, size_t ncols);
+void csv_writer_raw_row(struct csv_writer *w, const char *buf, size_t len,
+		const size_t *col_offs, size_t ncols);
+
 int strtoll_safe2(const char *str, long long *val, int base, bool verbose);
 int strtod_safe2(const char *str, double *val, bool verbose);
 
@@ -43,6 +110,17 @@ int strtoi_safe(const char *str, int *val, int base);
 int strtou_safe(const char *str, unsigned *val, int base);
 int strtod_safe(const char *str, double *val);
 
+/*
+ * Size of buffer which can hold any number formatted by csv_format_int or
+ * csv_format_double, including the terminating NUL.
+ */
+#define CSV_NUMBER_BUF_SIZE 320
+
+size_t csv_format_int(char *buf, long long val);
+size_t csv_format_double(char *buf, double val);
+void csv_print_int(FILE *out, long long val);
+void csv_print_double(FILE *out, double val);
+
 char *strnchr(const char *str, int c, size_t len);
 void print_timespec(const struct timespec *ts, bool nsec);
 
@@ -58,11 +136,55 @@ void csv_show(unsigned flags);
 void csv_substring_sanitize(const char *str, ssize_t *start, size_t *len);
 
 char *csv_unquot(const char *str);
+const char *csv_unquot_buf(const char *str, char **buf, size_t *size);
 #if 0
 /* currently not used */
 void csv_unquot_in_place(char *str);
 #endif
 
+/*
+ * Typed values of columns of the current row, decoded on first use and
+ * reused until csv_values_set_row is called for the next row.
+ */
+struct csv_value {
+	/* generation of the row for which each representation is valid */
+	unsigned long long int_gen;
+	unsigned long long dbl_gen;
+	unsigned long long str_gen;
+
+	long long llong;
+	double dbl;
+	/* unquoted string, the space is reused between rows */
+	char *unquoted;
+	size_t unquoted_size;
+};
+
+struct csv_values {
+	const char *buf;
+	const size_t *col_offs;
+	unsigned long long gen;
+
+	struct csv_value *vals;
+	size_t ncols;
+};
+
+void csv_values_init(struct csv_values *v, size_t ncols);
+void csv_values_fini(struct csv_values *v);
+
+static inline void
+csv_values_set_row(struct csv_values *v, const char *buf,
+		const size_t *col_offs)
+{
+	v->buf = buf;
+	v->col_offs = col_offs;
+	v->gen++;
+}
+
+int csv_values_int(struct csv_values *v, size_t col, long long *val);
+int csv_values_float(struct csv_values *v, size_t col, double *val);
+/* returned string is valid until the next call to csv_values_set_row */
+const char *csv_values_str(struct csv_values *v, size_t col);
+
 #define CSV_NOT_FOUND SIZE_MAX
 size_t csv_find(const struct col_header *headers,
 		size_t nheaders,
@@ -93,6 +215,24 @@ void *xcalloc_nofail(size_t count, size_t size);
 void *xrealloc(void *ptr, size_t count, size_t size);
 void *xrealloc_nofail(void *ptr, size_t count, size_t size);
 
+/*
+ * Bump allocator. Memory is handed out from big chunks and released all
+ * at once by csv_arena_reset or csv_arena_fini.
+ */
+struct csv_arena_chunk;
+
+struct csv_arena {
+	struct csv_arena_chunk *chunks;
+	size_t used;
+	size_t chunk_size;
+};
+
+void csv_arena_init(struct csv_arena *arena, size_t chunk_size);
+void *csv_arena_alloc(struct csv_arena *arena, size_t len);
+char *csv_arena_strndup(struct csv_arena *arena, const char *str, size_t len);
+void csv_arena_reset(struct csv_arena *arena);
+void csv_arena_fini(struct csv_arena *arena);
+
 enum rpn_token_type {
 	RPN_COLUMN,		/* column */
 	RPN_CONSTANT,		/* constant */
@@ -173,17 +313,44 @@ struct rpn_token {
 	};
 };
 
+struct rpn_insn;
+struct csv_regex;
+
 struct rpn_expression {
 	struct rpn_token *tokens;
 	size_t count;
+
+	/* evaluation state, set up by rpn_prepare */
+
+	/* typed code, NULL if expression doesn't type check */
+	struct rpn_insn *code;
+	size_t ncode;
+	/* strings produced by constant folding */
+	struct csv_arena consts;
+	/* compiled regular expressions with constant patterns */
+	struct csv_regex *regexes;
+	size_t nregexes;
+
+	struct rpn_variant *stack;
+	size_t max_height;
+	/* strings created by operators, freed at the start of each rpn_eval */
+	struct csv_arena scratch;
+	char *buf;
+	size_t buf_size;
 };
 
 int rpn_parse(struct rpn_expression *exp, char *str,
 		const struct col_header *headers, size_t nheaders,
 		const char *table);
-int rpn_eval(const struct rpn_expression *exp,
-		const char *buf,
-		const size_t *col_offs,
+void rpn_prepare(struct rpn_expression *exp);
+
+/*
+ * String result is borrowed from the row, the expression or its scratch
+ * space. It must not be freed and is valid only until the next call
+ * to rpn_eval for the same expression or until the row changes.
+ */
+int rpn_eval(struct rpn_expression *exp,
+		struct csv_values *row,
 		struct rpn_variant *value);
 
 const char *rpn_expression_type(const struct rpn_expression *exp,
@@ -242,6 +409,8 @@ void describe_Table(FILE *out);
 
 int csv_asprintf(char **strp, const char *fmt, ...);
 char *csv_strcasestr(const char *haystack, const char *needle);
+void *csv_memmem(const void *haystack, size_t haystacklen,
+		const void *needle, size_t needlelen);
 void csv_qsort_r(void *base, size_t nmemb, size_t size,
                   int (*compar)(const void *, const void *, void *),
                   void *arg);
@@ -266,10 +435,16 @@ struct line {
 	void *user;
 };
 
+/*
+ * Buffered rows. Row contents and column offsets are stored in an arena,
+ * which is released all at once by lines_fini.
+ */
 struct lines {
 	struct line *data;
 	size_t size;
 	size_t used;
+
+	struct csv_arena arena;
 };
 
 void lines_init(struct lines *lines);
@@ -279,8 +454,6 @@ int lines_add(struct lines *lines,
 	      const size_t *col_offs,
 	      size_t ncols);
 
-void lines_free_one(struct line *line);
-
 void lines_fini(struct lines *lines);
 
 #endif
@@ -29,6 +29,13 @@ csv_strcasestr(const char *haystack, const char *needle)
 	return strcasestr(haystack, needle);
 }
 
+void *
+csv_memmem(const void *haystack, size_t haystacklen, const void *needle,
+		size_t needlelen)
+{
+	return memmem(haystack, haystacklen, needle, needlelen);
+}
+
 void
 csv_qsort_r(void *base, size_t nmemb, size_t size,
                   int (*compar)(const void *, const void *, void *),
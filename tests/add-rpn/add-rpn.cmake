@@ -25,6 +25,10 @@ test("csv-add-rpn -n 'num2_div_num' -e '%num2 %num /'"
 	data/rpn-add-num-dec.csv data/rpn-add-num-div0.csv data/rpn-add-num-div0.txt 2
 	add-rpn_num_div0)
 
+test("csv-add-rpn -n r -e '%num 0 eq -1 %num2 %num / if'"
+	data/rpn-add-num-dec.csv add-rpn/short-circuit-if.csv data/empty.txt 0
+	add-rpn_short_circuit_if)
+
 test("csv-add-rpn -n 'num2_sub_num' -e '%num2 %num -'"
 	data/rpn-add-num-dec.csv data/rpn-add-num-sub.csv data/empty.txt 0
 	add-rpn_num_sub)
@@ -132,6 +136,14 @@ test("csv-add-rpn -n str1_like_%12 -e \"%str1 '%12' like\"\
 	data/rpn-add-str.csv data/rpn-add-str-like.csv data/empty.txt 0
 	add-rpn_str_like)
 
+test("csv-add-rpn -n mid -e \"%str1 'q%t%i%2' like\"\
+		  -n rep -e \"%str1 '%, %, %' like\"\
+		  -n dot -e \"%str1 '%m,.' like\"\
+		  -n overlap -e \"%str1 'qw%we%' like\"\
+		  -n pct -e \"%str1 '%%%' like\""
+	data/rpn-add-str.csv add-rpn/like-segments.csv data/empty.txt 0
+	add-rpn_str_like_segments)
+
 
 test("csv-add-rpn -n str_to_int -e '%str toint'\
 		  -n num_to_string   -e '%num 10 int2strb'\
@@ -183,6 +195,22 @@ test("csv-add-rpn -n col2tripled -e '%col2 3 *'"
 	data/floats.csv add-rpn/floats.csv data/empty.txt 0
 	add-rpn_floats)
 
+test("csv-add-rpn -n a -e '%col2 10 / %id 2 3 * + tofloat *' -n b -e \"'x' 'y' concat %id tostring concat\" -n c -e '%col1 %col3 lt 1 2 lt and'"
+	data/floats.csv add-rpn/floats-folded.csv data/empty.txt 0
+	add-rpn_constant_folding)
+
+test("csv-add-rpn -n a -e '%column1 %column2 %column1 concat concat' -n b -e '%column1 length'"
+	data/quotes.csv add-rpn/quotes-concat.csv data/empty.txt 0
+	add-rpn_quoted_column_reused)
+
+test("csv-add-rpn -n a -e \"%column1 1 5 substr %column2 concat 'o' 'OO' 0 replace\" -n b -e '%column3 strlen 15 gt %column1 %column3 if'"
+	data/quotes.csv add-rpn/quotes-string-ops.csv data/empty.txt 0
+	add-rpn_string_operators)
+
+test("csv-add-rpn -n s -e '%f flt2str' -n t -e '%i tostring' -n d -e '%f'"
+	add-rpn/format-input.csv add-rpn/format-output.csv data/empty.txt 0
+	add-rpn_number_formatting)
+
 test("csv-add-rpn --help" data/empty.csv add-rpn/help.txt data/empty.txt 2
 	add-rpn_help)
 
@@ -70,6 +70,18 @@ test("csv-grep-rpn -e \"%name '.*th.*' 1 matches_ere\"" data/3-columns-3-rows.cs
 test("csv-grep-rpn -e \"%name '.*th.*' 1 matches_bre\"" data/3-columns-3-rows.csv data/rpn-filter-rows-2-3.csv data/empty.txt 0
 	grep-rpn_matches_bre)
 
+test("csv-grep-rpn -e \"%name '.*th.*' 1 matches_bre\"" data/3-columns-3-rows.csv data/rpn-filter-rows-2-3.csv grep-rpn/regex-bound.txt 0
+	grep-rpn_matches_bound)
+append_envs(grep-rpn_matches_bound "CSVNIXTOOLS_REGEX_STATS=1")
+
+test("csv-grep-rpn -e \"%name %id 2 % 0 == 'th' 'or' if 1 matches_bre\"" data/3-columns-3-rows.csv grep-rpn/rows-1-2.csv grep-rpn/regex-cache-size-1.txt 0
+	grep-rpn_matches_cache_size_1)
+append_envs(grep-rpn_matches_cache_size_1 "CSVNIXTOOLS_REGEX_STATS=1;CSVNIXTOOLS_REGEX_CACHE_SIZE=1")
+
+test("csv-grep-rpn -e \"%name %id 2 % 0 == 'th' 'or' if 1 matches_bre\"" data/3-columns-3-rows.csv grep-rpn/rows-1-2.csv grep-rpn/regex-cache-size-2.txt 0
+	grep-rpn_matches_cache_size_2)
+append_envs(grep-rpn_matches_cache_size_2 "CSVNIXTOOLS_REGEX_STATS=1;CSVNIXTOOLS_REGEX_CACHE_SIZE=2")
+
 
 test("csv-grep-rpn -e \"%name '%ing.%' like\"" grep-rpn/special-chars.csv grep-rpn/special-chars-found1.csv data/empty.txt 0
 	grep-rpn_like_escape_dot)
@@ -544,6 +556,10 @@ test("csv-grep-rpn -e 'toint 3 / 333 =='" data/floats.csv grep-rpn/float-no-rows
 test("csv-grep-rpn -e \"%id tostring '2' ==\"" data/3-columns-3-rows.csv data/rpn-filter-row-2.csv data/empty.txt 0
 	grep-rpn_tostring_from_int)
 
+test("csv-grep-rpn -e '%num 0 ne 100 %num / 50 lt and'"
+	data/rpn-add-num-dec.csv grep-rpn/short-circuit-and.csv data/empty.txt 0
+	grep-rpn_short_circuit_and)
+
 test("csv-grep-rpn -e '%col2 tostring \"1000.000000\" =='" data/floats.csv grep-rpn/float-1000.csv data/empty.txt 0
 	grep-rpn_tostring_from_float)
 
@@ -10,6 +10,8 @@ test("csv-grep" data/one-column-one-row.csv data/empty.csv grep/help.txt 2
 test("csv-grep -c x -F y" data/empty.csv data/empty.csv data/eof.txt 2
 	grep_empty_input)
 
+test("csv-grep -c a -e x" data/row-bigger-than-buffer.csv data/row-bigger-than-buffer.csv data/empty.txt 0
+	grep_row_bigger_than_buffer)
 
 test("csv-grep -c name -e or" data/3-columns-3-rows.csv grep/name-or.csv data/empty.txt 0
 	grep_-c_name_-e_or)
@@ -33,6 +35,12 @@ test("csv-grep -c name -x -E or" data/3-columns-3-rows.csv grep/not-found.csv da
 test("csv-grep -c name -E or.m" data/3-columns-3-rows.csv grep/name-or.csv data/empty.txt 0
 	grep_-c_name_-E_or.m)
 
+test("csv-grep -c name -E 'lx*o(r|q)+em? [i]psu'" data/3-columns-3-rows.csv grep/name-or.csv data/empty.txt 0
+	grep_-c_name_-E_quantifiers)
+
+test("csv-grep -c name -i -e 'LOX*RE\\{0,1\\}M IP'" data/3-columns-3-rows.csv grep/name-or.csv data/empty.txt 0
+	grep_-c_name_-i_-e_quantifiers)
+
 
 test("csv-grep -c name -F or" data/3-columns-3-rows.csv grep/name-or.csv data/empty.txt 0
 	grep_-c_name_-F_or)
@@ -79,3 +87,10 @@ test("csv-grep --help" data/empty.csv grep/help.txt data/empty.txt 2
 
 test("csv-grep --version" data/empty.csv data/git-version.txt data/empty.txt 0
 	grep_version)
+
+test("csv-grep -T t1 -c id -e 7$" data/2-tables-1000-rows.csv grep/2-tables-1000-rows-7.csv data/empty.txt 0
+	grep_2_tables_1000_rows)
+
+test("csv-grep -T t1 -c id -e 7$" data/2-tables-1000-rows.csv grep/2-tables-1000-rows-7.csv data/empty.txt 0
+	grep_2_tables_1000_rows_threads)
+append_envs(grep_2_tables_1000_rows_threads "CSVNIXTOOLS_THREADS=4;CSVNIXTOOLS_BUFFER_SIZE=1k")
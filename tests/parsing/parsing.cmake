@@ -24,3 +24,71 @@ test("csv-cat" data/newlines.csv data/newlines.csv data/empty.txt 0
 
 test("csv-cat" data/quotes.csv data/quotes.csv data/empty.txt 0
 	parsing_quotes)
+
+test("csv-cat" parsing/long-fields.csv parsing/long-fields.csv data/empty.txt 0
+	parsing_long_fields)
+
+test("csv-cat" parsing/long-fields.csv parsing/long-fields.csv data/empty.txt 0
+	parsing_long_fields_no_simd)
+append_envs(parsing_long_fields_no_simd "CSVNIXTOOLS_SIMD=none")
+
+test("csv-cat" parsing/long-fields.csv parsing/long-fields.csv data/empty.txt 0
+	parsing_long_fields_sse2)
+append_envs(parsing_long_fields_sse2 "CSVNIXTOOLS_SIMD=sse2")
+
+test("csv-cat" data/quotes.csv data/quotes.csv data/empty.txt 0
+	parsing_quotes_no_simd)
+append_envs(parsing_quotes_no_simd "CSVNIXTOOLS_SIMD=none")
+
+test("csv-cat" parsing/long-fields.csv parsing/long-fields.csv data/empty.txt 0
+	parsing_long_fields_small_buffer)
+append_envs(parsing_long_fields_small_buffer "CSVNIXTOOLS_BUFFER_SIZE=7;CSVNIXTOOLS_MMAP=0")
+
+test("csv-cat" data/quotes.csv data/quotes.csv data/empty.txt 0
+	parsing_quotes_1_byte_buffer)
+append_envs(parsing_quotes_1_byte_buffer "CSVNIXTOOLS_BUFFER_SIZE=1;CSVNIXTOOLS_MMAP=0")
+
+test("cat | csv-cat" parsing/long-fields.csv parsing/long-fields.csv data/empty.txt 0
+	parsing_long_fields_pipe)
+
+test("csv-cat" parsing/long-fields.csv parsing/long-fields.csv data/empty.txt 0
+	parsing_long_fields_no_mmap)
+append_envs(parsing_long_fields_no_mmap "CSVNIXTOOLS_MMAP=0")
+
+test("head -n 1 > /dev/null && csv-cat" parsing/junk-line-and-3-columns-3-rows.csv data/3-columns-3-rows.csv data/empty.txt 0
+	parsing_mapped_file_not_from_the_beginning)
+
+test("csv-cat" parsing/quot-invalid-after-rows.csv parsing/quot-invalid-after-rows-stdout.csv data/quot-invalid-stderr.txt 2
+	parsing_quot_invalid_after_rows)
+
+test("csv-cat" parsing/long-fields.csv parsing/long-fields.csv data/empty.txt 0
+	parsing_long_fields_threads)
+append_envs(parsing_long_fields_threads "CSVNIXTOOLS_THREADS=3;CSVNIXTOOLS_BUFFER_SIZE=7")
+
+test("csv-cat" data/quotes.csv data/quotes.csv data/empty.txt 0
+	parsing_quotes_threads)
+append_envs(parsing_quotes_threads "CSVNIXTOOLS_THREADS=3;CSVNIXTOOLS_BUFFER_SIZE=5")
+
+test("csv-cat" data/newlines.csv data/newlines.csv data/empty.txt 0
+	parsing_newlines_threads)
+append_envs(parsing_newlines_threads "CSVNIXTOOLS_THREADS=3;CSVNIXTOOLS_BUFFER_SIZE=5")
+
+test("csv-cat" parsing/quot-invalid-after-rows.csv parsing/quot-invalid-after-rows-stdout.csv data/quot-invalid-stderr.txt 2
+	parsing_quot_invalid_after_rows_threads)
+append_envs(parsing_quot_invalid_after_rows_threads "CSVNIXTOOLS_THREADS=3;CSVNIXTOOLS_BUFFER_SIZE=5")
+
+test("cat | csv-cat" parsing/long-fields.csv parsing/long-fields.csv data/empty.txt 0
+	parsing_long_fields_pipe_readahead)
+append_envs(parsing_long_fields_pipe_readahead "CSVNIXTOOLS_BUFFER_SIZE=7")
+
+test("cat | csv-cat" data/quotes.csv data/quotes.csv data/empty.txt 0
+	parsing_quotes_pipe_readahead)
+append_envs(parsing_quotes_pipe_readahead "CSVNIXTOOLS_BUFFER_SIZE=2")
+
+test("cat | csv-cat" parsing/long-fields.csv parsing/long-fields.csv data/empty.txt 0
+	parsing_long_fields_pipe_no_readahead)
+append_envs(parsing_long_fields_pipe_no_readahead "CSVNIXTOOLS_BUFFER_SIZE=7;CSVNIXTOOLS_READAHEAD=0")
+
+test("csv-cat" data/3-columns-3-rows.csv data/empty.txt parsing/invalid-buffer-size.txt 2
+	parsing_invalid_buffer_size)
+append_envs(parsing_invalid_buffer_size "CSVNIXTOOLS_BUFFER_SIZE=5x")
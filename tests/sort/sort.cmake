@@ -25,6 +25,21 @@ test("csv-sort -T t1 -c id" sort/2-tables.csv sort/2-tables-sorted1.csv data/emp
 test("csv-sort -T t2 -c col2" sort/2-tables.csv sort/2-tables-sorted2.csv data/empty.txt 0
 	sort_2_tables_sort_2nd)
 
+test("csv-sort -c id,name --buffer-size=1" sort/2-cols.csv sort/2-cols-sorted.csv data/empty.txt 0
+	sort_2_cols_external)
+
+test("csv-sort -c id,name -r --buffer-size=1 --batch-size=2" sort/2-cols.csv sort/2-cols-rsorted.csv data/empty.txt 0
+	sort_2_cols_rsorted_external_multipass)
+
+test("csv-sort -T t2 -c col2 --buffer-size=1" sort/2-tables.csv sort/2-tables-sorted2.csv data/empty.txt 0
+	sort_2_tables_sort_2nd_external)
+
+test("csv-sort -c t1.name,t1.id -r --parallel=3" data/2-tables-1000-rows.csv sort/1000-rows-rsorted.csv data/empty.txt 0
+	sort_1000_rows_parallel)
+
+test("csv-sort -c t1.name,t1.id -r --parallel=2 --buffer-size=40k" data/2-tables-1000-rows.csv sort/1000-rows-rsorted.csv data/empty.txt 0
+	sort_1000_rows_parallel_external)
+
 test("csv-sort --help" data/empty.csv sort/help.txt data/empty.txt 2
 	sort_help)
 
@@ -33,3 +48,18 @@ test("csv-sort -c col3" data/floats.csv sort/floats.csv data/empty.txt 0
 
 test("csv-sort --version" data/empty.csv data/git-version.txt data/empty.txt 0
 	sort_version)
+
+test("csv-sort -c i,f,s" sort/numbers.csv sort/numbers-sorted.csv data/empty.txt 0
+	sort_numbers)
+
+test("csv-sort -c s,i" sort/numbers.csv sort/numbers-sorted-by-s.csv data/empty.txt 0
+	sort_numbers_by_string)
+
+test("csv-sort -c f,i -r" sort/numbers.csv sort/numbers-rsorted-by-f.csv data/empty.txt 0
+	sort_numbers_by_float_rsorted)
+
+test("csv-sort -c i,f --limit=4" sort/numbers.csv sort/numbers-sorted-limit-4.csv data/empty.txt 0
+	sort_numbers_limit)
+
+test("csv-sort -c t1.name,t1.id -r --limit=10" data/2-tables-1000-rows.csv sort/1000-rows-rsorted-limit-10.csv data/empty.txt 0
+	sort_1000_rows_rsorted_limit)
@@ -285,6 +285,14 @@ test("csv-sql 'select id, id/2 as id2, name from input order by id2, name desc'"
 	sql/order-by-in.csv sql/order-by-id2-name_desc.csv data/empty.txt 0
 	sql_order_by_id2_name_desc)
 
+test("csv-sql 'select id, name from input order by name asc, id desc limit 3'"
+	sql/order-by-in.csv sql/order-by-name_asc-id_desc-limit-3.csv data/empty.txt 0
+	sql_order_by_name_asc_id_desc_limit_3)
+
+test("csv-sql 'select id, name from input limit 2'"
+	sql/order-by-in.csv sql/limit-2.csv data/empty.txt 0
+	sql_limit_2)
+
 test("csv-sql 'select *, col2 * 3 as col2tripled from input'"
 	data/floats.csv sql/floats.csv data/empty.txt 0
 	sql_floats)
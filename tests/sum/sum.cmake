@@ -54,3 +54,9 @@ test("csv-sum --help" data/empty.csv sum/help.txt data/empty.txt 2
 
 test("csv-sum --version" data/empty.csv data/git-version.txt data/empty.txt 0
 	sum_version)
+
+test("csv-sum -T t1 -c id" data/2-tables-1000-rows.csv sum/2-tables-1000-rows.csv data/empty.txt 0
+	sum_2_tables_1000_rows)
+
+test("csv-sum -c i,f" sum/formats.csv sum/formats-sum.csv data/empty.txt 0
+	sum_number_formats)
@@ -29,3 +29,6 @@ test("csv-uniq --help" data/empty.csv uniq/help.txt data/empty.txt 2
 
 test("csv-uniq --version" data/empty.csv data/git-version.txt data/empty.txt 0
 	uniq_version)
+
+test("csv-uniq -c a" uniq/input5.csv uniq/output5.csv data/empty.txt 0
+	uniq_first_column)